@@ -22,6 +22,7 @@
 #include <radix/asm/pat.h>
 
 #include <radix/cpu.h>
+#include <radix/fpu.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/percpu.h>
@@ -907,6 +908,7 @@ int cpu_init(int ap)
 	}
 
 	pat_init();
+	fpu_init(ap);
 	set_cpu_online(processor_id());
 
 	return 0;
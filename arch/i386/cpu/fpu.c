@@ -0,0 +1,325 @@
+/*
+ * arch/i386/cpu/fpu.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/asm/regs.h>
+
+#include <radix/assert.h>
+#include <radix/atomic.h>
+#include <radix/compiler.h>
+#include <radix/cpu.h>
+#include <radix/error.h>
+#include <radix/fpu.h>
+#include <radix/irq.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/percpu.h>
+#include <radix/slab.h>
+#include <radix/smp.h>
+#include <radix/task.h>
+
+#include <rlibc/string.h>
+
+/*
+ * FPU, MMX and SSE register state is switched lazily. A task's state is
+ * only loaded into a CPU when it first uses an FPU instruction after
+ * being scheduled, which traps with a device not available exception
+ * (#NM) as long as CR0.TS is set. The task which last loaded its state
+ * on a CPU is the CPU's fpu_owner; if it is scheduled there again and
+ * its state has not been loaded anywhere else, it gets the registers
+ * back without a trap.
+ *
+ * A task which used the FPU during its timeslice has its state saved
+ * eagerly when it is switched out, so a task's in-memory state is always
+ * current unless it is the running owner. This allows tasks to migrate
+ * freely without having to fetch their state from another CPU.
+ */
+
+#define FXSAVE_SIZE     512
+#define FXSAVE_ALIGN    16
+#define XSAVE_ALIGN     64
+
+#define XCR0_X87        (1 << 0)
+#define XCR0_SSE        (1 << 1)
+#define XCR0_AVX        (1 << 2)
+
+#define MXCSR_DEFAULT   0x1F80
+
+enum fpu_save_method {
+	FPU_FXSAVE,
+	FPU_XSAVE,
+	FPU_XSAVEOPT
+};
+
+static struct slab_cache *fpu_cache = NULL;
+static unsigned int fpu_state_size;
+static enum fpu_save_method fpu_method;
+
+static DEFINE_PER_CPU(struct task *, fpu_owner) = NULL;
+static DEFINE_PER_CPU(unsigned long, kernel_fpu_irqstate);
+
+static __always_inline void clts(void)
+{
+	asm volatile("clts");
+}
+
+static __always_inline void stts(void)
+{
+	cpu_modify_cr0(0, CR0_TS);
+}
+
+static __always_inline int __fpu_live(void)
+{
+	return !(cpu_read_cr0() & CR0_TS);
+}
+
+static __always_inline void __xsetbv(uint32_t reg, uint64_t val)
+{
+	asm volatile("xsetbv"
+	             :
+	             : "c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+/* __fpu_save: save the CPU's FPU registers into `state` */
+static __always_inline void __fpu_save(void *state)
+{
+	switch (fpu_method) {
+	case FPU_XSAVEOPT:
+		asm volatile("xsaveopt (%0)"
+		             :
+		             : "r"(state), "a"(-1), "d"(-1)
+		             : "memory");
+		break;
+	case FPU_XSAVE:
+		asm volatile("xsave (%0)"
+		             :
+		             : "r"(state), "a"(-1), "d"(-1)
+		             : "memory");
+		break;
+	case FPU_FXSAVE:
+		asm volatile("fxsave (%0)" : : "r"(state) : "memory");
+		break;
+	}
+}
+
+/* __fpu_restore: load the CPU's FPU registers from `state` */
+static __always_inline void __fpu_restore(void *state)
+{
+	switch (fpu_method) {
+	case FPU_XSAVEOPT:
+	case FPU_XSAVE:
+		asm volatile("xrstor (%0)"
+		             :
+		             : "r"(state), "a"(-1), "d"(-1)
+		             : "memory");
+		break;
+	case FPU_FXSAVE:
+		asm volatile("fxrstor (%0)" : : "r"(state) : "memory");
+		break;
+	}
+}
+
+static __always_inline void __fpu_init_state(void)
+{
+	uint32_t mxcsr = MXCSR_DEFAULT;
+
+	asm volatile("fninit\n\t"
+	             "ldmxcsr %0"
+	             :
+	             : "m"(mxcsr));
+}
+
+static void fpu_state_init(void *p)
+{
+	/* the XSAVE header must be zeroed for the first XRSTOR */
+	memset(p, 0, fpu_state_size);
+}
+
+/*
+ * __fpu_xsave_setup:
+ * Enable XSAVE on the current processor for all supported x87, SSE and
+ * AVX state. Returns the size of the XSAVE area.
+ */
+static unsigned int __fpu_xsave_setup(void)
+{
+	unsigned long eax, ebx, ecx, edx;
+	uint64_t xcr0;
+
+	cpu_modify_cr4(0, CR4_OSXSAVE);
+
+	cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+	xcr0 = XCR0_X87 | XCR0_SSE;
+	if (cpu_supports(CPUID_AVX))
+		xcr0 |= eax & XCR0_AVX;
+	__xsetbv(0, xcr0);
+
+	/* ebx is updated to reflect the components enabled in XCR0 */
+	cpuid_count(0xD, 0, eax, ebx, ecx, edx);
+	return ebx;
+}
+
+/*
+ * fpu_init:
+ * Enable the FPU and SSE on the current processor and set up lazy FPU
+ * state switching. On the BSP, this also chooses how to save FPU state.
+ */
+void fpu_init(int ap)
+{
+	unsigned long eax, ebx, ecx, edx;
+	unsigned int size;
+
+	if (!cpu_supports(CPUID_FPU | CPUID_FXSR)) {
+		if (!ap) {
+			klog(KLOG_WARNING, "fpu: FXSAVE not supported, "
+			     "FPU and SIMD disabled");
+		}
+		return;
+	}
+
+	cpu_modify_cr0(CR0_EM, CR0_MP | CR0_NE);
+	cpu_modify_cr4(0, CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+	size = FXSAVE_SIZE;
+	if (cpu_supports(CPUID_XSAVE))
+		size = __fpu_xsave_setup();
+
+	/* no task owns the FPU; the first to use it will trap */
+	stts();
+
+	if (ap)
+		return;
+
+	fpu_state_size = size;
+	if (cpu_supports(CPUID_XSAVE)) {
+		cpuid_count(0xD, 1, eax, ebx, ecx, edx);
+		fpu_method = (eax & 1) ? FPU_XSAVEOPT : FPU_XSAVE;
+		fpu_cache = create_cache("fpu_state", size, XSAVE_ALIGN,
+		                         SLAB_PANIC, fpu_state_init);
+	} else {
+		fpu_method = FPU_FXSAVE;
+		fpu_cache = create_cache("fpu_state", size, FXSAVE_ALIGN,
+		                         SLAB_PANIC, fpu_state_init);
+	}
+}
+
+/*
+ * device_not_available_handler:
+ * Give the current task ownership of this CPU's FPU, loading its saved
+ * register state or initializing a new one on first use.
+ */
+void device_not_available_handler(struct regs *regs, __unused int error)
+{
+	struct task *curr;
+
+	curr = current_task();
+	if (!curr || !fpu_cache)
+		panic("unexpected FPU instruction at eip %p", regs->ip);
+
+	clts();
+	if (curr->fpu_state) {
+		__fpu_restore(curr->fpu_state);
+	} else {
+		curr->fpu_state = alloc_cache(fpu_cache);
+		if (IS_ERR(curr->fpu_state))
+			panic("failed to allocate FPU state\n");
+		__fpu_init_state();
+	}
+
+	this_cpu_write(fpu_owner, curr);
+	curr->fpu_cpu = processor_id();
+}
+
+/*
+ * i386_fpu_switch:
+ * Prepare the FPU for a context switch from `prev` to `next`.
+ * Called with interrupts disabled.
+ */
+void i386_fpu_switch(struct task *prev, struct task *next)
+{
+	struct task *owner;
+
+	if (!fpu_cache)
+		return;
+
+	owner = raw_cpu_read(fpu_owner);
+
+	/* the outgoing task used the FPU during its timeslice */
+	if (prev && prev == owner && prev->fpu_state && __fpu_live())
+		__fpu_save(prev->fpu_state);
+
+	if (next == owner && next->fpu_state &&
+	    next->fpu_cpu == processor_id())
+		clts();
+	else
+		stts();
+}
+
+/*
+ * i386_fpu_task_exit:
+ * Release the FPU state of exiting task `t`. The task may still be
+ * recorded as the owner of the FPU of any CPU on which it has run,
+ * so it is cleared from all of them before its struct can be reused.
+ */
+void i386_fpu_task_exit(struct task *t)
+{
+	int cpu;
+
+	if (!t->fpu_state)
+		return;
+
+	for_each_cpu(cpu, cpumask_online()) {
+		atomic_cmpxchg((unsigned long *)cpu_ptr(&fpu_owner, cpu),
+		               (unsigned long)t, 0);
+	}
+
+	free_cache(fpu_cache, t->fpu_state);
+	t->fpu_state = NULL;
+}
+
+/*
+ * i386_kernel_fpu_begin:
+ * Allow the kernel to use the FPU in the current context, saving the
+ * state of the task which owns it if it has been modified.
+ */
+void i386_kernel_fpu_begin(void)
+{
+	struct task *owner;
+	unsigned long irqstate;
+
+	irq_save(irqstate);
+
+	if (fpu_cache) {
+		owner = raw_cpu_read(fpu_owner);
+		if (owner && owner == current_task() && __fpu_live())
+			__fpu_save(owner->fpu_state);
+		raw_cpu_write(fpu_owner, NULL);
+	}
+
+	clts();
+	raw_cpu_write(kernel_fpu_irqstate, irqstate);
+}
+
+/*
+ * i386_kernel_fpu_end:
+ * End a kernel FPU section. The FPU no longer has an owner, so the next
+ * task to use it will trap and reload its own state.
+ */
+void i386_kernel_fpu_end(void)
+{
+	stts();
+	irq_restore(raw_cpu_read(kernel_fpu_irqstate));
+}
@@ -18,10 +18,52 @@
 
 #include <radix/asm/gdt.h>
 #include <radix/asm/regs.h>
+#include <radix/asm/task_offsets.h>
 
+#include <radix/compiler.h>
 #include <radix/cpu.h>
 #include <radix/kthread.h>
 #include <radix/mm_types.h>
+#include <radix/task.h>
+
+#define check_offset(sym, type, member)                                 \
+	static_assert(offsetof(type, member) == sym,                    \
+	              #sym " does not match offset of " #type "." #member)
+
+/* the offsets used by assembly code must match the C structures */
+check_offset(TASK_REGS, struct task, regs);
+check_offset(REGS_DI, struct regs, di);
+check_offset(REGS_SI, struct regs, si);
+check_offset(REGS_SP, struct regs, sp);
+check_offset(REGS_BP, struct regs, bp);
+check_offset(REGS_BX, struct regs, bx);
+check_offset(REGS_DX, struct regs, dx);
+check_offset(REGS_CX, struct regs, cx);
+check_offset(REGS_AX, struct regs, ax);
+check_offset(REGS_GS, struct regs, gs);
+check_offset(REGS_FS, struct regs, fs);
+check_offset(REGS_ES, struct regs, es);
+check_offset(REGS_DS, struct regs, ds);
+check_offset(REGS_CS, struct regs, cs);
+check_offset(REGS_SS, struct regs, ss);
+check_offset(REGS_IP, struct regs, ip);
+check_offset(REGS_FLAGS, struct regs, flags);
+static_assert(sizeof (struct regs) == REGS_SIZE, "REGS_SIZE is incorrect");
+
+/*
+ * Set up the segment registers in `r` for a task running in the kernel.
+ * switch_task does not save these, so they must be valid from the start
+ * for the task to be resumable from an interrupt.
+ */
+void kernel_reg_setup(struct regs *r)
+{
+	r->gs = GDT_OFFSET(GDT_GS);
+	r->fs = GDT_OFFSET(GDT_FS);
+	r->es = GDT_OFFSET(GDT_KERNEL_DATA);
+	r->ds = GDT_OFFSET(GDT_KERNEL_DATA);
+	r->ss = GDT_OFFSET(GDT_KERNEL_DATA);
+	r->cs = GDT_OFFSET(GDT_KERNEL_CODE);
+}
 
 /*
  * Setup stack and registers for a kthread to execute function func
@@ -44,12 +86,6 @@ void kthread_reg_setup(struct regs *r, addr_t stack, addr_t func, addr_t arg)
 	r->sp = (addr_t)(s - 5);
 	r->ip = (addr_t)func;
 
-	r->gs = GDT_OFFSET(GDT_GS);
-	r->fs = GDT_OFFSET(GDT_FS);
-	r->es = GDT_OFFSET(GDT_KERNEL_DATA);
-	r->ds = GDT_OFFSET(GDT_KERNEL_DATA);
-	r->ss = GDT_OFFSET(GDT_KERNEL_DATA);
-
-	r->cs = GDT_OFFSET(GDT_KERNEL_CODE);
+	kernel_reg_setup(r);
 	r->flags = EFLAGS_IF | EFLAGS_ID;
 }
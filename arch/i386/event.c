@@ -20,6 +20,8 @@
 #include <radix/asm/regs.h>
 
 #include <radix/event.h>
+#include <radix/irq.h>
+#include <radix/softirq.h>
 #include <rlibc/string.h>
 #include <radix/task.h>
 
@@ -44,4 +46,7 @@ void arch_event_handler(struct interrupt_context *intctx)
 	event_handler();
 	memcpy(&intctx->regs, &current_task()->regs, sizeof intctx->regs);
 	update_intctx(intctx);
+
+	if (this_cpu_read(interrupt_depth) == 1)
+		do_softirq();
 }
@@ -28,6 +28,7 @@
 
 #define __arch_atomic_swap      x86_atomic_swap
 #define __arch_atomic_write     x86_atomic_write
+#define __arch_atomic_cmpxchg   x86_atomic_cmpxchg
 
 static __always_inline int x86_atomic_swap(unsigned long *a, unsigned long b)
 {
@@ -40,4 +41,22 @@ static __always_inline void x86_atomic_write(unsigned long *p, unsigned long val
 	asm volatile("movl %1, %0" : "=m"(*p) : "r"(val) : "memory");
 }
 
+/*
+ * x86_atomic_cmpxchg:
+ * Store `new` in `*p` if it currently holds `old`.
+ * Returns the value of `*p` before the operation.
+ */
+static __always_inline unsigned long x86_atomic_cmpxchg(unsigned long *p,
+                                                        unsigned long old,
+                                                        unsigned long new)
+{
+	unsigned long prev;
+
+	asm volatile("lock; cmpxchgl %2, %1"
+	             : "=a"(prev), "+m"(*p)
+	             : "r"(new), "0"(old)
+	             : "memory");
+	return prev;
+}
+
 #endif /* ARCH_I386_RADIX_ATOMIC_H */
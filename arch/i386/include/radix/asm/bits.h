@@ -39,8 +39,12 @@
 	__fop_ret;                                                      \
 })
 
+/*
+ * Constant arguments go through the generic versions so that they can be
+ * folded at compile time; everything else uses a single bit scan instruction.
+ */
 #define __fop(name, x) \
-	(!is_immediate(x) ? __##name##_generic(x) : __fop_size(name, x))
+	(is_immediate(x) ? __##name##_generic(x) : __fop_size(name, x))
 
 #define ffs(x) __fop(ffs, x)
 #define fls(x) __fop(fls, x)
@@ -60,7 +64,7 @@ static __always_inline unsigned int __ffs_32(uint32_t x)
 	return r + 1;
 }
 
-static __always_inline unsigned int __ffs_64(uint32_t x)
+static __always_inline unsigned int __ffs_64(uint64_t x)
 {
 #ifdef CONFIG_X86_64
 	int pos = -1;
@@ -52,12 +52,30 @@ int cpu_supports(uint64_t features);
 #define __arch_cache_line_size()        i386_cache_line_size()
 #define __arch_set_kernel_stack(s)      i386_set_kernel_stack(s)
 #define __arch_cache_str()              i386_cache_str()
+#define __arch_cpu_cycles()             rdtsc()
+#define __arch_idle_has_monitor()       cpu_supports(CPUID_MONITOR)
+#define __arch_idle_monitor(flag)       i386_idle_monitor(flag)
+#define __arch_idle_halt()              cpu_halt_irq_enable()
 
 void read_cpu_info(void);
 
 void bsp_init(void);
 int cpu_init(int ap);
 
+/*
+ * i386_idle_monitor:
+ * Called with interrupts disabled. Enable them and wait until `*flag`
+ * is written or an interrupt arrives.
+ */
+static __always_inline void i386_idle_monitor(volatile unsigned long *flag)
+{
+	cpu_monitor(flag);
+	if (*flag)
+		asm volatile("sti" : : : "memory");
+	else
+		cpu_mwait_irq_enable();
+}
+
 unsigned long i386_cache_line_size(void);
 void i386_set_kernel_stack(void *stack);
 char *i386_cache_str(void);
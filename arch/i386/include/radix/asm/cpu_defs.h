@@ -159,6 +159,14 @@
 
 #ifdef __KERNEL__
 
+static __always_inline unsigned long cpu_read_cr0(void)
+{
+	unsigned long ret;
+
+	asm volatile("mov %%cr0, %0" : "=r"(ret));
+	return ret;
+}
+
 static __always_inline unsigned long cpu_read_cr2(void)
 {
 	unsigned long ret;
@@ -179,6 +187,13 @@ static __always_inline void cpu_write_cr3(unsigned long val)
 	             : "=a"(a), "=r"(b), "=c"(c), "=d"(d)       \
 	             : "0"(eax))
 
+#define cpuid_count(eax, ecx, a, b, c, d)                       \
+	asm volatile("xchg %%ebx, %1\n\t"                       \
+	             "cpuid\n\t"                                \
+	             "xchg %%ebx, %1"                           \
+	             : "=a"(a), "=r"(b), "=c"(c), "=d"(d)       \
+	             : "0"(eax), "2"(ecx))
+
 #define __modify_control_register(cr, clear, set)               \
 	asm volatile("movl %%" cr ", %%eax\n\t"                 \
 	             "andl %0, %%eax\n\t"                       \
@@ -217,6 +232,43 @@ static __always_inline void cpu_update_flags(unsigned long clear,
 
 #define cpu_pause() asm volatile("pause")
 
+/* arm address monitoring hardware on the cache line containing `addr` */
+static __always_inline void cpu_monitor(const volatile void *addr)
+{
+	asm volatile("monitor" : : "a"(addr), "c"(0), "d"(0));
+}
+
+/*
+ * Enable interrupts and wait for a write to the monitored cache line
+ * or an interrupt. The sti shadow ensures no interrupt is lost between
+ * the two instructions.
+ */
+static __always_inline void cpu_mwait_irq_enable(void)
+{
+	asm volatile("sti\n\t"
+	             "mwait"
+	             :
+	             : "a"(0), "c"(0)
+	             : "memory");
+}
+
+/* Enable interrupts and halt until the next one arrives. */
+static __always_inline void cpu_halt_irq_enable(void)
+{
+	asm volatile("sti\n\t"
+	             "hlt"
+	             : : : "memory");
+}
+
+/* read the processor's time stamp counter */
+static __always_inline unsigned long long rdtsc(void)
+{
+	unsigned long long ret;
+
+	asm volatile("rdtsc" : "=A"(ret));
+	return ret;
+}
+
 #endif /* __KERNEL__ */
 
 #endif /* ARCH_I386_RADIX_CPU_DEFS_H */
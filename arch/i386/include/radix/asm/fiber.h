@@ -0,0 +1,59 @@
+/*
+ * arch/i386/include/radix/asm/fiber.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_I386_RADIX_FIBER_H
+#define ARCH_I386_RADIX_FIBER_H
+
+#ifndef RADIX_FIBER_H
+#error only <radix/fiber.h> can be included directly
+#endif
+
+#include <radix/compiler.h>
+#include <radix/types.h>
+
+struct fiber;
+
+void fiber_switch(unsigned long *save_sp, unsigned long sp);
+void fiber_trampoline(void);
+
+/*
+ * i386_fiber_stack_init:
+ * Set up the stack ending at `top` so that the first fiber_switch to the
+ * returned stack pointer enters fiber_trampoline with `f` in %ebx.
+ * The frame matches the callee-saved registers popped by fiber_switch.
+ */
+static __always_inline unsigned long i386_fiber_stack_init(void *top,
+                                                           struct fiber *f)
+{
+	unsigned long *sp;
+
+	sp = (unsigned long *)((unsigned long)top & ~0xFUL);
+
+	*--sp = (unsigned long)fiber_trampoline;
+	*--sp = 0;                      /* ebp */
+	*--sp = (unsigned long)f;       /* ebx */
+	*--sp = 0;                      /* esi */
+	*--sp = 0;                      /* edi */
+
+	return (unsigned long)sp;
+}
+
+#define __arch_fiber_stack_init(top, f) i386_fiber_stack_init(top, f)
+#define __arch_fiber_switch(save, sp)   fiber_switch(save, sp)
+
+#endif /* ARCH_I386_RADIX_FIBER_H */
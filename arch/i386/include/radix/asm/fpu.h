@@ -0,0 +1,42 @@
+/*
+ * arch/i386/include/radix/asm/fpu.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_I386_RADIX_FPU_H
+#define ARCH_I386_RADIX_FPU_H
+
+#ifndef RADIX_FPU_H
+#error only <radix/fpu.h> can be included directly
+#endif
+
+struct regs;
+struct task;
+
+#define __arch_kernel_fpu_begin()       i386_kernel_fpu_begin()
+#define __arch_kernel_fpu_end()         i386_kernel_fpu_end()
+#define __arch_fpu_switch(prev, next)   i386_fpu_switch(prev, next)
+#define __arch_fpu_task_exit(t)         i386_fpu_task_exit(t)
+
+void i386_kernel_fpu_begin(void);
+void i386_kernel_fpu_end(void);
+void i386_fpu_switch(struct task *prev, struct task *next);
+void i386_fpu_task_exit(struct task *t);
+
+void fpu_init(int ap);
+void device_not_available_handler(struct regs *regs, int error);
+
+#endif /* ARCH_I386_RADIX_FPU_H */
@@ -54,6 +54,7 @@ struct interrupt_context {
 	uint32_t        ss;
 };
 
+void kernel_reg_setup(struct regs *r);
 void kthread_reg_setup(struct regs *r, addr_t stack, addr_t func, addr_t arg);
 
 #endif /* ARCH_I386_RADIX_REGS_H */
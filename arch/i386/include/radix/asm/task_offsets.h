@@ -0,0 +1,49 @@
+/*
+ * arch/i386/include/radix/asm/task_offsets.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_I386_RADIX_TASK_OFFSETS_H
+#define ARCH_I386_RADIX_TASK_OFFSETS_H
+
+/*
+ * Byte offsets of the members of struct regs and of the regs member of
+ * struct task, for use in assembly code. Each of these is checked against
+ * the C structure definitions at compile time in arch/i386/cpu/regs.c.
+ */
+
+#define TASK_REGS       32
+
+#define REGS_DI         0
+#define REGS_SI         4
+#define REGS_SP         8
+#define REGS_BP         12
+#define REGS_BX         16
+#define REGS_DX         20
+#define REGS_CX         24
+#define REGS_AX         28
+#define REGS_GS         32
+#define REGS_FS         36
+#define REGS_ES         40
+#define REGS_DS         44
+#define REGS_CS         48
+#define REGS_SS         52
+#define REGS_IP         56
+#define REGS_FLAGS      60
+
+#define REGS_SIZE       64
+
+#endif /* ARCH_I386_RADIX_TASK_OFFSETS_H */
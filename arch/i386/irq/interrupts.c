@@ -25,6 +25,7 @@
 #include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/slab.h>
+#include <radix/softirq.h>
 #include <radix/task.h>
 
 #include <rlibc/string.h>
@@ -232,6 +233,9 @@ void interrupt_handler(__unused struct regs *regs, int intno)
 	desc = &irq_descriptors[intno];
 	for (; desc; desc = desc->next)
 		desc->handler(desc->device);
+
+	if (this_cpu_read(interrupt_depth) == 1)
+		do_softirq();
 }
 
 int in_interrupt(void)
@@ -63,7 +63,7 @@ static void do_kernel_pf(addr_t fault_addr, int error)
 	 * As the system grows, time spent in page faults should be profiled to
 	 * determine whether optimization is necessary.
 	 */
-	p = alloc_page(PA_USER);
+	p = alloc_page(PA_USER | __PA_NOFAIL);
 	if (IS_ERR(p)) {
 		/*
 		 * TODO: figure out the best actions to take
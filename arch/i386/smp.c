@@ -87,10 +87,11 @@ void arch_smp_boot(void)
 	                virt_to_phys(smp_tramp_start),
                         PROT_WRITE, PAGE_CP_DEFAULT);
 
-	memcpy(smp_tramp->mem, (void *)smp_tramp_start, smp_tramp_size);
+	memcpy(page_address(smp_tramp), (void *)smp_tramp_start,
+	       smp_tramp_size);
 
 	/* point the gdt descriptor to the AP GDT */
-	gd = smp_tramp->mem + gdtr_offset;
+	gd = page_address(smp_tramp) + gdtr_offset;
 	gd->size = sizeof ap_gdt;
 	gd->addr = virt_to_phys(ap_gdt);
 
@@ -131,7 +132,7 @@ void ap_entry(void)
 	this_cpu_write(__this_cpu_offset, offset);
 
 	p = alloc_page(PA_STANDARD);
-	stack_top = p->mem + PAGE_SIZE;
+	stack_top = page_address(p) + PAGE_SIZE;
 	this_cpu_write(cpu_stack, stack_top);
 
 	ap_switch_stack(stack_top);
@@ -23,5 +23,6 @@
 
 #define atomic_swap(p, val)     __arch_atomic_swap(p, val)
 #define atomic_write(p, val)    __arch_atomic_write(p, val)
+#define atomic_cmpxchg(p, o, n) __arch_atomic_cmpxchg(p, o, n)
 
 #endif /* RADIX_ATOMIC_H */
@@ -35,6 +35,8 @@
 
 #define offsetof(type, member) __builtin_offsetof(type, member)
 
+#define static_assert(expr, msg) _Static_assert(expr, msg)
+
 #define container_of(ptr, type, member)                         \
 ({                                                              \
 	const typeof(((type *)0)->member) *__ptr = (ptr);       \
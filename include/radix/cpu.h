@@ -24,5 +24,10 @@
 #define cpu_cache_line_size()   __arch_cache_line_size()
 #define cpu_set_kernel_stack(s) __arch_set_kernel_stack(s)
 #define cpu_cache_str()         __arch_cache_str()
+#define cpu_cycles()            __arch_cpu_cycles()
+
+#define cpu_idle_has_monitor()  __arch_idle_has_monitor()
+#define cpu_idle_monitor(flag)  __arch_idle_monitor(flag)
+#define cpu_idle_halt()         __arch_idle_halt()
 
 #endif /* RADIX_CPU_H */
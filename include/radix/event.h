@@ -33,4 +33,15 @@ void timekeeping_event_update(uint64_t period);
 int sched_event_add(uint64_t timestamp);
 void sched_event_del(void);
 
+struct task;
+
+int sleep_event_add(struct task *t, uint64_t timestamp);
+void sleep_event_del(struct task *t);
+int dl_event_add(struct task *t, uint64_t timestamp);
+void dl_event_del(struct task *t);
+
+struct delayed_work;
+
+int work_event_add(struct delayed_work *dw, uint64_t timestamp);
+
 #endif /* RADIX_EVENT_H */
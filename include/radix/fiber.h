@@ -0,0 +1,87 @@
+/*
+ * include/radix/fiber.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_FIBER_H
+#define RADIX_FIBER_H
+
+#include <radix/asm/fiber.h>
+
+#include <radix/list.h>
+#include <radix/mm.h>
+#include <radix/spinlock.h>
+#include <radix/types.h>
+#include <radix/wait.h>
+
+/*
+ * Fibers are cooperatively scheduled threads of execution which live
+ * inside a kernel thread. Switching between fibers only swaps stacks;
+ * the scheduler is not involved. A fiber runs until it yields, parks or
+ * returns, so it must never block its kernel thread for long.
+ *
+ * Interrupts taken while a fiber runs use the fiber's stack, including
+ * the scheduler when called from the timer, so stacks are whole pages of
+ * at least FIBER_STACK_MIN bytes. Softirqs are never run on them.
+ */
+#define FIBER_STACK_MIN         PAGE_SIZE
+#define FIBER_STACK_DEFAULT     (2 * PAGE_SIZE)
+
+enum fiber_state {
+	FIBER_READY,
+	FIBER_RUNNING,
+	FIBER_PARKED,
+	FIBER_DONE
+};
+
+struct fiber_executor;
+
+struct fiber {
+	unsigned long           sp;
+	unsigned long           resume_sp;
+	struct fiber            *resumer;
+	void                    (*func)(void *);
+	void                    *arg;
+	void                    *stack;
+	int                     state;
+	int                     wake_pending;
+	struct fiber_executor   *exec;
+	struct list             list;
+};
+
+/* A kernel thread which runs many fibers in turn. */
+struct fiber_executor {
+	spinlock_t              lock;
+	struct list             runnable;
+	struct wait_queue       wq;
+	struct task             *thread;
+	int                     nr_fibers;
+};
+
+struct fiber *fiber_create(void (*func)(void *), void *arg, size_t stack_size);
+void fiber_destroy(struct fiber *f);
+
+void fiber_resume(struct fiber *f);
+void fiber_yield(void);
+void fiber_park(void);
+void fiber_wake(struct fiber *f);
+
+struct fiber *current_fiber(void);
+
+struct fiber_executor *fiber_executor_create(char *name);
+int fiber_spawn(struct fiber_executor *exec, struct fiber *f);
+
+#endif /* RADIX_FIBER_H */
@@ -0,0 +1,37 @@
+/*
+ * include/radix/fpu.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_FPU_H
+#define RADIX_FPU_H
+
+#include <radix/asm/fpu.h>
+
+/*
+ * Code which uses floating point or SIMD registers outside of a task's
+ * own lazily switched FPU context, such as in an interrupt handler or a
+ * vectorized library routine, must wrap the usage in kernel_fpu_begin()
+ * and kernel_fpu_end(). Interrupts are disabled in between, so these
+ * sections should be kept short. They cannot be nested.
+ */
+#define kernel_fpu_begin()      __arch_kernel_fpu_begin()
+#define kernel_fpu_end()        __arch_kernel_fpu_end()
+
+#define fpu_switch(prev, next)  __arch_fpu_switch(prev, next)
+#define fpu_task_exit(t)        __arch_fpu_task_exit(t)
+
+#endif /* RADIX_FPU_H */
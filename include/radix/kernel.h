@@ -41,6 +41,8 @@
 	_mina < _minb ? _mina : _minb;  \
 })
 
+#define clamp(x, lo, hi) min(max(x, lo), hi)
+
 #define swap(a, b)                      \
 do {                                    \
 	typeof(a) __tmp = (a);          \
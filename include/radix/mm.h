@@ -66,17 +66,23 @@ void buddy_init(struct multiboot_info *mbt);
 #define __PA_NO_MAP     (1 << 5)        /* don't map pages to virtual address */
 #define __PA_ZERO       (1 << 6)        /* zero pages when allocated */
 #define __PA_READONLY   (1 << 7)        /* mark pages as readonly */
+#define __PA_NOFAIL     (1 << 8)        /* may use zones' reserved pages */
 
 /* Page allocation flags */
 #define PA_STANDARD     (__PA_ZONE_REG)
 #define PA_READONLY     (__PA_ZONE_REG | __PA_READONLY)
 #define PA_DMA          (__PA_ZONE_DMA | __PA_NO_MAP)
 #define PA_USER         (__PA_ZONE_USR | __PA_NO_MAP)
-#define PA_PAGETABLE    (__PA_ZONE_USR | __PA_NO_MAP)
+#define PA_PAGETABLE    (__PA_ZONE_USR | __PA_NO_MAP | __PA_NOFAIL)
 #define PA_LOWMEM       (__PA_ZONE_LOW)
 
 struct page *alloc_pages(unsigned int flags, size_t ord);
 void free_pages(struct page *p);
+size_t alloc_pages_bulk(unsigned int flags, size_t ord,
+                        size_t n, struct page **pages);
+void free_pages_bulk(struct page **pages, size_t n);
+void page_cache_enable(void);
+void page_reclaim_enable(void);
 void mark_page_mapped(struct page *p, addr_t virt);
 
 static __always_inline struct page *alloc_page(unsigned int flags)
@@ -112,6 +118,20 @@ static __always_inline struct page *phys_to_page(paddr_t phys)
 	return page_map + (phys >> PAGE_SHIFT);
 }
 
+/*
+ * page_address:
+ * Return the virtual address at which the mapped block `p` can be accessed.
+ * User zone blocks are mapped individually; all other memory lies in the
+ * direct map.
+ */
+static __always_inline void *page_address(struct page *p)
+{
+	if (p->status & PM_PAGE_ZONE_USR)
+		return p->mem;
+
+	return (void *)phys_to_virt(page_to_phys(p));
+}
+
 /*
  * Memory management functions.
  * Each supported architecture must provide its own implementation
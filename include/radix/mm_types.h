@@ -24,7 +24,7 @@
 
 /*
  * page status (32-bit):
- * FFFFFFFFFFFFZARIMCCCCCCCUUUUOOOO
+ * FFFFFFFFFFSVZARIMCCCCCCCUUUUOOOO
  *
  * OOOO - block order number (first page in block) or PM_PAGE_ORDER_INNER
  * UUUU - maximum order to which pages in block can be coalesced
@@ -34,17 +34,19 @@
  * R    - reserved bit. 1: reserved for kernel use, 0: can be allocated
  * A    - allocated bit. 1: allocated, 0: free (only in valid, unreserved pages)
  * Z    - zone bit. 1: user zone, 0: regular zone
- * F12  - offset of page within its maximum block
+ * V    - vmm bit. 1: mapped into a vmm_area at `mem`, 0: not
+ * S    - slab bit. 1: holds slab objects, 0: does not
+ * F10  - offset of page within its maximum block
  */
 #define __ORDER_MASK            0x0000000F
 #define __MAX_ORDER_MASK        0x000000F0
 #define __REFCOUNT_MASK         0x00007F00
-#define __OFFSET_MASK           0xFFF00000
+#define __OFFSET_MASK           0xFFC00000
 
 #define __ORDER_SHIFT           0
 #define __MAX_ORDER_SHIFT       4
 #define __REFCOUNT_SHIFT        8
-#define __OFFSET_SHIFT          20
+#define __OFFSET_SHIFT          22
 
 /*
  * The first page in a block stores the order of the whole block.
@@ -90,13 +92,29 @@ do {                                                    \
 #define PM_PAGE_RESERVED        (1 << 17)
 #define PM_PAGE_ALLOCATED       (1 << 18)
 #define PM_PAGE_ZONE_USR        (1 << 19)
+#define PM_PAGE_VMM             (1 << 20)
+#define PM_PAGE_SLAB            (1 << 21)
 
+/*
+ * The list is used while a block is free, cached or owned by a vmm_block,
+ * and the slab fields while it holds a slab, so the two share space. Only
+ * pages with PM_PAGE_SLAB set may have their slab fields read.
+ *
+ * `mem` holds the mapping of user zone blocks and of any block mapped into
+ * a vmm_area, which may have come from another zone. Every other page is
+ * accessed through the direct map. Use page_address() rather than reading
+ * it.
+ */
 struct page {
-	void            *slab_cache;    /* address of slab cache */
-	void            *slab_desc;     /* address of slab descriptor */
-	void            *mem;           /* start of the page itself */
-	unsigned long   status;         /* information about state */
-	struct list     list;           /* buddy allocator list */
+	unsigned long           status;         /* information about state */
+	union {
+		struct list     list;           /* buddy allocator list */
+		struct {
+			void    *slab_cache;    /* address of slab cache */
+			void    *slab_desc;     /* address of slab descriptor */
+		};
+	};
+	void                    *mem;           /* mapping outside direct map */
 };
 
 #endif /* RADIX_MM_TYPES_H */
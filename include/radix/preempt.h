@@ -0,0 +1,81 @@
+/*
+ * include/radix/preempt.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_PREEMPT_H
+#define RADIX_PREEMPT_H
+
+#include <radix/compiler.h>
+#include <radix/percpu.h>
+
+/*
+ * While a CPU's preempt_count is nonzero, the task running on it will not
+ * be preempted by the scheduler. A preemption which is requested in that
+ * time is recorded in preempt_pending and carried out by the outermost
+ * preempt_enable(), or as soon as the interrupt which is returning to
+ * the task allows it.
+ *
+ * Disabling preemption keeps the current task on its CPU, which makes
+ * it safe to access per-CPU data which is not used by interrupt handlers
+ * without disabling interrupts.
+ */
+DECLARE_PER_CPU(int, preempt_count);
+DECLARE_PER_CPU(int, preempt_pending);
+
+void preempt_schedule(void);
+
+#define preempt_count()         this_cpu_read(preempt_count)
+#define preemptible()           (!preempt_count())
+
+#define preempt_disable()                       \
+do {                                            \
+	this_cpu_inc(preempt_count);            \
+	barrier();                              \
+} while (0)
+
+#define preempt_enable_no_resched()             \
+do {                                            \
+	barrier();                              \
+	this_cpu_dec(preempt_count);            \
+} while (0)
+
+#define preempt_enable()                                        \
+do {                                                            \
+	preempt_enable_no_resched();                            \
+	if (unlikely(!preempt_count() &&                        \
+	             this_cpu_read(preempt_pending)))           \
+		preempt_schedule();                             \
+} while (0)
+
+/*
+ * get_cpu_ptr:
+ * Return the current CPU's instance of per-CPU variable `ptr`, disabling
+ * preemption until it is released with put_cpu_ptr().
+ */
+#define get_cpu_ptr(ptr)                        \
+({                                              \
+	preempt_disable();                      \
+	raw_cpu_ptr(ptr);                       \
+})
+
+#define put_cpu_ptr(ptr)                        \
+do {                                            \
+	(void)(ptr);                            \
+	preempt_enable();                       \
+} while (0)
+
+#endif /* RADIX_PREEMPT_H */
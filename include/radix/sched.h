@@ -21,6 +21,8 @@
 
 #include <radix/task.h>
 
+#define SCHED_PRIO_LEVELS 20
+
 void schedule(int preempt);
 
 int sched_init(void);
@@ -30,4 +32,23 @@ void sched_del(struct task *t);
 
 void sched_unblock(struct task *t);
 
+int sched_set_deadline(struct task *t, uint64_t runtime,
+                       uint64_t deadline, uint64_t period);
+
+int schedule_timeout(uint64_t deadline);
+int sleep_until(uint64_t timestamp);
+int sleep_ns(uint64_t ns);
+
+#ifdef CONFIG_SCHED_STATS
+void sched_stats_dump(void);
+#else
+#define sched_stats_dump()
+#endif /* CONFIG_SCHED_STATS */
+
+#ifdef CONFIG_SCHED_BENCH
+void sched_bench(void);
+#else
+#define sched_bench()
+#endif /* CONFIG_SCHED_BENCH */
+
 #endif /* RADIX_SCHED_H */
@@ -0,0 +1,40 @@
+/*
+ * include/radix/shrinker.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_SHRINKER_H
+#define RADIX_SHRINKER_H
+
+#include <radix/list.h>
+
+/*
+ * A shrinker releases memory held by a subsystem when the page allocator
+ * runs low. Its callback is asked to free up to `nr_pages` pages and
+ * returns the number it freed. Callbacks are run from the page reclaim
+ * work and may sleep, but must not register or unregister shrinkers.
+ */
+struct shrinker {
+	unsigned long   (*shrink)(struct shrinker *s, unsigned long nr_pages);
+	struct list     list;
+};
+
+int register_shrinker(struct shrinker *s);
+void unregister_shrinker(struct shrinker *s);
+
+unsigned long shrink_memory(unsigned long nr_pages);
+
+#endif /* RADIX_SHRINKER_H */
@@ -19,12 +19,35 @@
 #ifndef RADIX_SLAB_H
 #define RADIX_SLAB_H
 
+#include <radix/cpumask.h>
 #include <radix/list.h>
 #include <radix/spinlock.h>
 #include <radix/types.h>
 
 #define NAME_LEN        0x40
 
+/*
+ * Each CPU keeps a loaded and a previous magazine of free objects for every
+ * cache. Objects are allocated from and freed to the loaded magazine, and
+ * the two are swapped when it runs empty or full, so most operations only
+ * touch the current CPU's magazines. Only once both are exhausted does the
+ * CPU trade one with the cache's depot of full and empty magazines, or fall
+ * back to the slabs.
+ */
+struct slab_magazine {
+	struct list     list;                   /* depot list */
+	unsigned int    size;                   /* capacity of the magazine */
+	unsigned int    rounds;                 /* number of objects held */
+	void            *objs[];
+};
+
+struct slab_cpu {
+	struct slab_magazine    *loaded;
+	struct slab_magazine    *prev;
+};
+
+#define SLAB_MAG_MAX    0x40
+
 struct slab_cache {
 	size_t          objsize;                /* size of each cached object */
 	size_t          align;                  /* object alignment */
@@ -40,6 +63,12 @@ struct slab_cache {
 	struct list     free_slabs;             /* empty slabs */
 	struct list     list;                   /* list of caches */
 
+	unsigned int    mag_size;               /* size of new magazines */
+	struct slab_cpu cpu_mags[MAX_CPUS];     /* per-CPU magazines */
+	spinlock_t      depot_lock;             /* depot spinlock */
+	struct list     depot_full;             /* full magazines */
+	struct list     depot_empty;            /* empty magazines */
+
 	char            cache_name[NAME_LEN];   /* human-readable cache name */
 };
 
@@ -61,6 +90,8 @@ void destroy_cache(struct slab_cache *cache);
 
 int grow_cache(struct slab_cache *cache);
 int shrink_cache(struct slab_cache *cache);
+int shrink_all_caches(void);
+int set_cache_magazine_size(struct slab_cache *cache, unsigned int size);
 
 void *alloc_cache(struct slab_cache *cache);
 void free_cache(struct slab_cache *cache, void *obj);
@@ -0,0 +1,60 @@
+/*
+ * include/radix/softirq.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_SOFTIRQ_H
+#define RADIX_SOFTIRQ_H
+
+/*
+ * Softirqs are the deferred halves of interrupt handlers. A raised
+ * softirq runs on the same CPU with interrupts enabled, either when the
+ * outermost interrupt returns or, if they keep getting raised, in the
+ * CPU's ksoftirqd thread. Softirq handlers must not block.
+ */
+enum {
+	SOFTIRQ_HI,
+	SOFTIRQ_TASKLET,
+	NR_SOFTIRQS
+};
+
+typedef void (*softirq_handler_t)(void);
+
+void softirq_init(void);
+
+void open_softirq(int nr, softirq_handler_t handler);
+void raise_softirq(int nr);
+void do_softirq(void);
+int in_softirq(void);
+
+/* A function run once in softirq context each time it is scheduled. */
+struct tasklet {
+	struct tasklet  *next;
+	unsigned long   state;
+	void            (*func)(void *);
+	void            *data;
+};
+
+#define TASKLET_INIT(fn, arg) { NULL, 0, (fn), (arg) }
+
+#define DEFINE_TASKLET(name, fn, arg) \
+	struct tasklet name = TASKLET_INIT(fn, arg)
+
+void tasklet_init(struct tasklet *t, void (*func)(void *), void *data);
+void tasklet_schedule(struct tasklet *t);
+void tasklet_hi_schedule(struct tasklet *t);
+
+#endif /* RADIX_SOFTIRQ_H */
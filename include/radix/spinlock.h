@@ -22,6 +22,7 @@
 #include <radix/atomic.h>
 #include <radix/compiler.h>
 #include <radix/irqstate.h>
+#include <radix/preempt.h>
 
 typedef unsigned long spinlock_t;
 
@@ -43,20 +44,24 @@ static __always_inline void spin_init(spinlock_t *lock)
 	atomic_write(lock, 0);
 }
 
+/* Holding a spinlock disables preemption on the current CPU. */
 static __always_inline void spin_lock(spinlock_t *lock)
 {
+	preempt_disable();
 	__spinlock_acquire(lock);
 }
 
 static __always_inline void spin_unlock(spinlock_t *lock)
 {
 	__spinlock_release(lock);
+	preempt_enable();
 }
 
 static __always_inline void spin_lock_irq(spinlock_t *lock,
                                           unsigned long *irqstate)
 {
 	irq_save(*irqstate);
+	preempt_disable();
 	__spinlock_acquire(lock);
 }
 
@@ -65,6 +70,7 @@ static __always_inline void spin_unlock_irq(spinlock_t *lock,
 {
 	__spinlock_release(lock);
 	irq_restore(irqstate);
+	preempt_enable();
 }
 
 #endif /* RADIX_SPINLOCK_H */
@@ -25,18 +25,22 @@
 #include <radix/list.h>
 #include <radix/mm_types.h>
 #include <radix/percpu.h>
+#include <radix/rbtree.h>
 #include <radix/types.h>
 
+struct event;
+struct fiber;
 struct vmm_space;
 
 /*
  * A single task (process/kthread) in the system.
  *
- * Rearranging the members of this struct requires changes
- * to be made to the switch_task function.
+ * The offset of the regs member is used by assembly code. Rearranging
+ * the members of this struct requires TASK_REGS in
+ * <radix/asm/task_offsets.h> to be updated.
  */
 struct task {
-	int                     state;
+	unsigned long           state;
 	int                     priority;
 	int                     exit_status;
 	int                     errno;
@@ -55,6 +59,30 @@ struct task {
 	char                    **cmdline;
 	char                    *cwd;
 	int                     prio_level;
+	int                     cpu;
+	struct event            *sleep_event;
+	uint64_t                queue_ts;
+	uint64_t                vruntime;
+	int64_t                 vlag;
+	struct rb_node          fair_node;
+	uint64_t                dl_runtime;
+	uint64_t                dl_deadline;
+	uint64_t                dl_period;
+	uint64_t                dl_abs_deadline;
+	int64_t                 dl_budget;
+	struct event            *dl_timer;
+	struct rb_node          dl_node;
+	void                    *fpu_state;
+	int                     fpu_cpu;
+	struct task             *wake_next;
+	int                     wake_flags;
+	uint64_t                acct_ts;
+	uint64_t                run_cycles;
+	uint64_t                wait_cycles;
+	unsigned long           nr_voluntary;
+	unsigned long           nr_involuntary;
+	struct list             task_list;
+	struct fiber            *fiber;
 };
 
 enum task_state {
@@ -62,7 +90,8 @@ enum task_state {
 	TASK_READY,
 	TASK_BLOCKED,
 	TASK_RUNNING,
-	TASK_ZOMBIE
+	TASK_ZOMBIE,
+	TASK_ASLEEP     /* blocked and switched out, waiting to be woken */
 };
 
 DECLARE_PER_CPU(struct task *, current_task);
@@ -21,10 +21,14 @@
 
 #include <radix/task.h>
 
+#define TASK_DUMP_MAX 16
+
 void tasking_init(void);
 struct task *kthread_task(void);
 void task_free(struct task *task);
 
+void task_dump_top(int n);
+
 void switch_task(struct task *old, struct task *new);
 
 #endif /* RADIX_TASKING_H */
@@ -0,0 +1,89 @@
+/*
+ * include/radix/wait.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_WAIT_H
+#define RADIX_WAIT_H
+
+#include <radix/list.h>
+#include <radix/sched.h>
+#include <radix/spinlock.h>
+#include <radix/task.h>
+#include <radix/time.h>
+
+/* A list of tasks waiting for some condition to become true. */
+struct wait_queue {
+	struct list     head;
+	spinlock_t      lock;
+};
+
+/* A single task's entry in a wait queue, usually allocated on its stack. */
+struct wait_entry {
+	struct task     *task;
+	struct list     list;
+};
+
+#define WAIT_QUEUE_INIT(name) { LIST_INIT((name).head), SPINLOCK_INIT }
+
+#define DEFINE_WAIT(name) \
+	struct wait_entry name = { current_task(), LIST_INIT((name).list) }
+
+void wait_queue_init(struct wait_queue *wq);
+
+void prepare_to_wait(struct wait_queue *wq, struct wait_entry *w);
+void finish_wait(struct wait_queue *wq, struct wait_entry *w);
+
+void wake_up(struct wait_queue *wq);
+void wake_up_all(struct wait_queue *wq);
+
+/*
+ * __wait_event:
+ * Block the current task on wait queue `wq` until `cond` is true or the
+ * time `deadline` is reached. Evaluates to 1 if `cond` became true and
+ * 0 if the wait timed out.
+ */
+#define __wait_event(wq, cond, deadline)                        \
+({                                                              \
+	DEFINE_WAIT(__w);                                       \
+	uint64_t __deadline = (deadline);                       \
+	int __ret;                                              \
+                                                                \
+	while (1) {                                             \
+		prepare_to_wait(wq, &__w);                      \
+		if ((__ret = !!(cond)))                         \
+			break;                                  \
+		if (schedule_timeout(__deadline) != 0) {        \
+			__ret = !!(cond);                       \
+			break;                                  \
+		}                                               \
+	}                                                       \
+	finish_wait(wq, &__w);                                  \
+	__ret;                                                  \
+})
+
+/* wait_event: block on `wq` until `cond` is true */
+#define wait_event(wq, cond) ((void)__wait_event(wq, cond, 0))
+
+/*
+ * wait_event_timeout:
+ * Block on `wq` until `cond` is true or `ns` nanoseconds have passed.
+ * Returns 1 if `cond` is true and 0 on timeout.
+ */
+#define wait_event_timeout(wq, cond, ns) \
+	__wait_event(wq, cond, time_ns() + (ns))
+
+#endif /* RADIX_WAIT_H */
@@ -0,0 +1,69 @@
+/*
+ * include/radix/workqueue.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_WORKQUEUE_H
+#define RADIX_WORKQUEUE_H
+
+#include <radix/compiler.h>
+#include <radix/list.h>
+#include <radix/types.h>
+
+struct event;
+struct work;
+
+typedef void (*work_func_t)(struct work *);
+
+/*
+ * A function to be run later, in process context, by one of the
+ * kernel's per-CPU worker threads.
+ */
+struct work {
+	struct list     list;
+	work_func_t     func;
+	unsigned long   pending;
+	int             cpu;
+};
+
+/* A work item which is queued after a delay. */
+struct delayed_work {
+	struct work     work;
+	struct event    *event;
+};
+
+#define WORK_INIT(name, fn) { LIST_INIT((name).list), (fn), 0, 0 }
+#define DELAYED_WORK_INIT(name, fn) { WORK_INIT((name).work, fn), NULL }
+
+#define DEFINE_WORK(name, fn) struct work name = WORK_INIT(name, fn)
+#define DEFINE_DELAYED_WORK(name, fn) \
+	struct delayed_work name = DELAYED_WORK_INIT(name, fn)
+
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+void workqueue_init(void);
+
+void work_init(struct work *w, work_func_t func);
+void delayed_work_init(struct delayed_work *dw, work_func_t func);
+
+int queue_work(struct work *w);
+int queue_work_on(int cpu, struct work *w);
+int queue_delayed_work(struct delayed_work *dw, uint64_t delay);
+void flush_work(struct work *w);
+
+void delayed_work_timer(struct delayed_work *dw);
+
+#endif /* RADIX_WORKQUEUE_H */
@@ -29,12 +29,15 @@
 #include <radix/task.h>
 #include <radix/timer.h>
 #include <radix/time.h>
+#include <radix/workqueue.h>
 
 enum event_type {
 	EVENT_SCHED,
 	EVENT_SLEEP,
 	EVENT_TIME,
-	EVENT_DUMMY
+	EVENT_DUMMY,
+	EVENT_WORK,
+	EVENT_DEADLINE
 };
 
 struct event {
@@ -43,13 +46,14 @@ struct event {
 	union {
 		uint64_t        tk_period;
 		struct task     *sl_task;
+		struct delayed_work *wk_work;
 	};
 	struct list             list;
 };
 
-#define EVENT_STATIC (1 << 2)
+#define EVENT_STATIC (1 << 3)
 
-#define EVENT_TYPE(evt) ((evt)->flags & 0x3)
+#define EVENT_TYPE(evt) ((evt)->flags & 0x7)
 
 static struct slab_cache *event_cache;
 
@@ -68,6 +72,8 @@ static void event_process(struct event *evt)
 		schedule(0);
 		break;
 	case EVENT_SLEEP:
+		evt->sl_task->sleep_event = NULL;
+		sched_unblock(evt->sl_task);
 		break;
 	case EVENT_TIME:
 		timer_accumulate();
@@ -76,6 +82,14 @@ static void event_process(struct event *evt)
 		break;
 	case EVENT_DUMMY:
 		break;
+	case EVENT_WORK:
+		evt->wk_work->event = NULL;
+		delayed_work_timer(evt->wk_work);
+		break;
+	case EVENT_DEADLINE:
+		evt->sl_task->dl_timer = NULL;
+		sched_unblock(evt->sl_task);
+		break;
 	}
 }
 
@@ -318,26 +332,134 @@ void sched_event_del(void)
 {
 	struct list *eventq;
 	struct event *evt;
+	int first;
 
 	evt = this_cpu_read(sched_event);
 	if (!evt)
 		return;
 
 	eventq = this_cpu_ptr(&event_queue);
+	first = evt->list.prev == eventq;
+	list_del(&evt->list);
 
 	/* sched event was first in queue; must schedule next event */
-	if (evt->list.prev == eventq) {
+	if (first) {
 		if (list_empty(eventq))
 			schedule_timer_irq(0);
 		else
 			__event_schedule(list_first_entry(eventq, struct event, list));
 	}
 
-	list_del(&evt->list);
 	this_cpu_write(sched_event, NULL);
 	event_free(evt);
 }
 
+/*
+ * sleep_event_add:
+ * Insert an event to wake up task `t` at the specified timestamp.
+ * The event is queued on the current CPU and must be deleted from it.
+ */
+int sleep_event_add(struct task *t, uint64_t timestamp)
+{
+	struct event *evt;
+
+	evt = event_alloc();
+	if (IS_ERR(evt))
+		return ERR_VAL(evt);
+
+	evt->time = timestamp;
+	evt->flags = EVENT_SLEEP;
+	evt->sl_task = t;
+
+	__event_add(evt);
+	t->sleep_event = evt;
+
+	return 0;
+}
+
+/*
+ * sleep_event_del:
+ * Delete task `t`'s pending sleep event, if it has not yet occurred.
+ * Must be called on the CPU on which the event was added.
+ */
+void sleep_event_del(struct task *t)
+{
+	struct event *evt;
+
+	evt = t->sleep_event;
+	if (!evt)
+		return;
+
+	__event_remove(evt);
+	t->sleep_event = NULL;
+	event_free(evt);
+}
+
+/*
+ * dl_event_add:
+ * Insert an event to wake throttled deadline task `t` at the start of its
+ * next period. This is kept apart from the task's sleep event, which may
+ * be in use at the same time. The event must be deleted from this CPU.
+ */
+int dl_event_add(struct task *t, uint64_t timestamp)
+{
+	struct event *evt;
+
+	evt = event_alloc();
+	if (IS_ERR(evt))
+		return ERR_VAL(evt);
+
+	evt->time = timestamp;
+	evt->flags = EVENT_DEADLINE;
+	evt->sl_task = t;
+
+	__event_add(evt);
+	t->dl_timer = evt;
+
+	return 0;
+}
+
+/*
+ * dl_event_del:
+ * Delete task `t`'s pending period event, if it has not yet occurred.
+ * Must be called on the CPU on which the event was added.
+ */
+void dl_event_del(struct task *t)
+{
+	struct event *evt;
+
+	evt = t->dl_timer;
+	if (!evt)
+		return;
+
+	__event_remove(evt);
+	t->dl_timer = NULL;
+	event_free(evt);
+}
+
+/*
+ * work_event_add:
+ * Insert an event to queue delayed work `dw` at the specified timestamp.
+ * The work is queued on the CPU on which the event was added.
+ */
+int work_event_add(struct delayed_work *dw, uint64_t timestamp)
+{
+	struct event *evt;
+
+	evt = event_alloc();
+	if (IS_ERR(evt))
+		return ERR_VAL(evt);
+
+	evt->time = timestamp;
+	evt->flags = EVENT_WORK;
+	evt->wk_work = dw;
+
+	__event_add(evt);
+	dw->event = evt;
+
+	return 0;
+}
+
 /*
  * cpu_event_init:
  * Initialize the per-CPU structures required for each CPU.
@@ -0,0 +1,310 @@
+/*
+ * kernel/fiber.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/assert.h>
+#include <radix/bits.h>
+#include <radix/error.h>
+#include <radix/fiber.h>
+#include <radix/kernel.h>
+#include <radix/kthread.h>
+#include <radix/slab.h>
+#include <radix/task.h>
+
+__noreturn void fiber_main(struct fiber *f);
+
+/*
+ * fiber_create:
+ * Create a fiber which runs `func(arg)` on a stack of `stack_size` bytes,
+ * or FIBER_STACK_DEFAULT if `stack_size` is 0. The stack is rounded up to
+ * a power of two number of pages. The fiber does not start running until
+ * it is resumed or spawned on an executor.
+ */
+struct fiber *fiber_create(void (*func)(void *), void *arg, size_t stack_size)
+{
+	struct fiber *f;
+	struct page *p;
+	size_t ord;
+
+	if (!stack_size)
+		stack_size = FIBER_STACK_DEFAULT;
+
+	if (unlikely(!func || stack_size < FIBER_STACK_MIN ||
+	             stack_size > pow2(PA_MAX_ORDER) * PAGE_SIZE))
+		return ERR_PTR(EINVAL);
+
+	/* keep stacks away from slab objects, which an overflow would hit */
+	ord = 0;
+	if (stack_size > PAGE_SIZE)
+		ord = log2((stack_size - 1) / PAGE_SIZE) + 1;
+	stack_size = pow2(ord) * PAGE_SIZE;
+
+	f = kmalloc(sizeof *f);
+	if (!f)
+		return ERR_PTR(ENOMEM);
+
+	p = alloc_pages(PA_STANDARD, ord);
+	if (IS_ERR(p)) {
+		kfree(f);
+		return ERR_PTR(ENOMEM);
+	}
+	f->stack = page_address(p);
+
+	f->func = func;
+	f->arg = arg;
+	f->state = FIBER_READY;
+	f->wake_pending = 0;
+	f->resumer = NULL;
+	f->exec = NULL;
+	list_init(&f->list);
+	f->sp = __arch_fiber_stack_init((char *)f->stack + stack_size, f);
+
+	return f;
+}
+
+/*
+ * fiber_destroy:
+ * Free fiber `f`. The fiber must not be running or queued to run.
+ * Fibers spawned on an executor are destroyed by it once they return.
+ */
+void fiber_destroy(struct fiber *f)
+{
+	free_pages(virt_to_page(f->stack));
+	kfree(f);
+}
+
+/* current_fiber: return the fiber running in the current task, if any */
+struct fiber *current_fiber(void)
+{
+	return current_task()->fiber;
+}
+
+/*
+ * fiber_resume:
+ * Switch from the caller to fiber `f`, which runs until it yields, parks
+ * or returns. Fibers may resume other fibers, in which case control
+ * returns to the resuming fiber.
+ */
+void fiber_resume(struct fiber *f)
+{
+	struct task *curr;
+
+	assert(f->state != FIBER_DONE);
+
+	curr = current_task();
+	f->resumer = curr->fiber;
+	f->state = FIBER_RUNNING;
+	curr->fiber = f;
+
+	__arch_fiber_switch(&f->resume_sp, f->sp);
+
+	curr->fiber = f->resumer;
+}
+
+/* __fiber_leave: switch from fiber `f` back to whoever resumed it */
+static __always_inline void __fiber_leave(struct fiber *f)
+{
+	__arch_fiber_switch(&f->sp, f->resume_sp);
+}
+
+/*
+ * fiber_yield:
+ * Return control from the current fiber to its resumer.
+ * The fiber remains runnable.
+ */
+void fiber_yield(void)
+{
+	struct fiber *f;
+
+	f = current_fiber();
+	assert(f);
+
+	__fiber_leave(f);
+}
+
+/*
+ * fiber_park:
+ * Stop running the current fiber, which must belong to an executor,
+ * until fiber_wake() is called on it. If the fiber was woken since it
+ * last parked, return immediately instead.
+ */
+void fiber_park(void)
+{
+	struct fiber_executor *exec;
+	struct fiber *f;
+	unsigned long irqstate;
+
+	f = current_fiber();
+	assert(f && f->exec);
+	exec = f->exec;
+
+	spin_lock_irq(&exec->lock, &irqstate);
+	if (f->wake_pending) {
+		f->wake_pending = 0;
+		spin_unlock_irq(&exec->lock, irqstate);
+		return;
+	}
+	f->state = FIBER_PARKED;
+	spin_unlock_irq(&exec->lock, irqstate);
+
+	/*
+	 * The fiber can be requeued by a wake from here on, but only its
+	 * own executor can resume it, which is what is running it now.
+	 */
+	__fiber_leave(f);
+}
+
+/*
+ * fiber_wake:
+ * Make parked fiber `f` runnable on its executor. If `f` is running,
+ * its next call to fiber_park() returns immediately. May be called from
+ * interrupt context.
+ */
+void fiber_wake(struct fiber *f)
+{
+	struct fiber_executor *exec;
+	unsigned long irqstate;
+	int wake;
+
+	exec = f->exec;
+	assert(exec);
+	wake = 0;
+
+	spin_lock_irq(&exec->lock, &irqstate);
+	if (f->state == FIBER_PARKED) {
+		f->state = FIBER_READY;
+		list_ins(&exec->runnable, &f->list);
+		wake = 1;
+	} else if (f->state == FIBER_RUNNING) {
+		f->wake_pending = 1;
+	}
+	spin_unlock_irq(&exec->lock, irqstate);
+
+	if (wake)
+		wake_up(&exec->wq);
+}
+
+/*
+ * fiber_main:
+ * First function run on a fiber's stack. Runs the fiber's function and
+ * leaves the fiber for good when it returns.
+ */
+__noreturn void fiber_main(struct fiber *f)
+{
+	f->func(f->arg);
+
+	f->state = FIBER_DONE;
+	__fiber_leave(f);
+
+	panic("fiber %p resumed after returning\n", f);
+}
+
+static void fiber_executor_thread(void *arg)
+{
+	struct fiber_executor *exec;
+	struct fiber *f;
+	unsigned long irqstate;
+	int done;
+
+	exec = arg;
+
+	while (1) {
+		wait_event(&exec->wq, !list_empty(&exec->runnable));
+
+		spin_lock_irq(&exec->lock, &irqstate);
+		if (list_empty(&exec->runnable)) {
+			spin_unlock_irq(&exec->lock, irqstate);
+			continue;
+		}
+		f = list_first_entry(&exec->runnable, struct fiber, list);
+		list_del(&f->list);
+		spin_unlock_irq(&exec->lock, irqstate);
+
+		fiber_resume(f);
+
+		/*
+		 * A fiber which is still marked running has yielded and goes
+		 * to the back of the queue. One which parked was either left
+		 * parked or has already been requeued by a wake.
+		 */
+		done = 0;
+		spin_lock_irq(&exec->lock, &irqstate);
+		if (f->state == FIBER_RUNNING) {
+			f->state = FIBER_READY;
+			list_ins(&exec->runnable, &f->list);
+		} else if (f->state == FIBER_DONE) {
+			--exec->nr_fibers;
+			done = 1;
+		}
+		spin_unlock_irq(&exec->lock, irqstate);
+
+		if (done)
+			fiber_destroy(f);
+	}
+}
+
+/*
+ * fiber_executor_create:
+ * Start a kernel thread called `name` which runs the fibers spawned on it
+ * in round-robin order, sleeping while none of them is runnable.
+ */
+struct fiber_executor *fiber_executor_create(char *name)
+{
+	struct fiber_executor *exec;
+	struct task *thread;
+
+	exec = kmalloc(sizeof *exec);
+	if (!exec)
+		return ERR_PTR(ENOMEM);
+
+	spin_init(&exec->lock);
+	list_init(&exec->runnable);
+	wait_queue_init(&exec->wq);
+	exec->nr_fibers = 0;
+
+	thread = kthread_run(fiber_executor_thread, exec, 0, "%s", name);
+	if (IS_ERR(thread)) {
+		kfree(exec);
+		return (void *)thread;
+	}
+	exec->thread = thread;
+
+	return exec;
+}
+
+/*
+ * fiber_spawn:
+ * Hand newly created fiber `f` to executor `exec`, which starts running
+ * it and frees it once it returns.
+ */
+int fiber_spawn(struct fiber_executor *exec, struct fiber *f)
+{
+	unsigned long irqstate;
+
+	if (unlikely(f->exec || f->state != FIBER_READY))
+		return EINVAL;
+
+	f->exec = exec;
+
+	spin_lock_irq(&exec->lock, &irqstate);
+	++exec->nr_fibers;
+	list_ins(&exec->runnable, &f->list);
+	spin_unlock_irq(&exec->lock, irqstate);
+
+	wake_up(&exec->wq);
+	return 0;
+}
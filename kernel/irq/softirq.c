@@ -0,0 +1,317 @@
+/*
+ * kernel/irq/softirq.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/atomic.h>
+#include <radix/error.h>
+#include <radix/irq.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/percpu.h>
+#include <radix/preempt.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/softirq.h>
+#include <radix/time.h>
+
+#include <rlibc/string.h>
+
+/*
+ * Limits on the amount of softirq processing done when an interrupt
+ * returns. Anything still pending after this is left to ksoftirqd.
+ */
+#define SOFTIRQ_MAX_RESTART     10
+#define SOFTIRQ_MAX_TIME        (2 * NSEC_PER_MSEC)
+
+#define TASKLET_SCHED           (1 << 0)
+#define TASKLET_RUN             (1 << 1)
+
+struct tasklet_list {
+	struct tasklet  *head;
+	struct tasklet  *tail;
+};
+
+static softirq_handler_t softirq_vec[NR_SOFTIRQS];
+
+static DEFINE_PER_CPU(unsigned long, softirq_pending) = 0;
+static DEFINE_PER_CPU(int, softirq_running) = 0;
+static DEFINE_PER_CPU(struct task *, ksoftirqd) = NULL;
+
+static DEFINE_PER_CPU(struct tasklet_list, tasklet_vec);
+static DEFINE_PER_CPU(struct tasklet_list, tasklet_hi_vec);
+
+void open_softirq(int nr, softirq_handler_t handler)
+{
+	softirq_vec[nr] = handler;
+}
+
+static __always_inline void __raise_softirq(int nr)
+{
+	this_cpu_write(softirq_pending,
+	               this_cpu_read(softirq_pending) | (1UL << nr));
+}
+
+static void __wake_ksoftirqd(void)
+{
+	struct task *t;
+
+	t = this_cpu_read(ksoftirqd);
+	if (t && t != current_task())
+		sched_unblock(t);
+}
+
+/*
+ * raise_softirq:
+ * Mark softirq `nr` as pending on the current CPU. Outside of interrupt
+ * context, there is no interrupt return to run it, so ksoftirqd is woken.
+ */
+void raise_softirq(int nr)
+{
+	unsigned long irqstate;
+
+	irq_save(irqstate);
+	__raise_softirq(nr);
+	if (!in_irq())
+		__wake_ksoftirqd();
+	irq_restore(irqstate);
+}
+
+/* in_softirq: check if the current CPU is running softirqs */
+int in_softirq(void)
+{
+	return this_cpu_read(softirq_running);
+}
+
+/*
+ * __do_softirq:
+ * Run the current CPU's pending softirqs with interrupts enabled, until
+ * there are none left or the processing limits are reached. Softirqs run
+ * on the stack of the task they interrupted, so they cannot be preempted.
+ */
+static void __do_softirq(void)
+{
+	unsigned long pending, irqstate;
+	uint64_t end;
+	int restart, nr;
+
+	irq_save(irqstate);
+	if (this_cpu_read(softirq_running)) {
+		irq_restore(irqstate);
+		return;
+	}
+
+	preempt_disable();
+	this_cpu_write(softirq_running, 1);
+	end = time_ns() + SOFTIRQ_MAX_TIME;
+	restart = SOFTIRQ_MAX_RESTART;
+
+	while ((pending = this_cpu_read(softirq_pending))) {
+		this_cpu_write(softirq_pending, 0);
+		irq_enable();
+
+		for (nr = 0; pending; ++nr, pending >>= 1) {
+			if (pending & 1)
+				softirq_vec[nr]();
+		}
+
+		irq_disable();
+		if (!--restart || time_ns() >= end)
+			break;
+	}
+
+	this_cpu_write(softirq_running, 0);
+
+	if (this_cpu_read(softirq_pending))
+		__wake_ksoftirqd();
+
+	/* any preemption requested while running is deferred to an IPI */
+	preempt_enable();
+	irq_restore(irqstate);
+}
+
+/*
+ * do_softirq:
+ * Run any pending softirqs on the current CPU. Called by architecture
+ * code as the outermost interrupt on a CPU returns. Fiber stacks are too
+ * small to run softirqs on, so those interrupted on a fiber are left to
+ * ksoftirqd.
+ */
+void do_softirq(void)
+{
+	struct task *curr;
+
+	if (!this_cpu_read(softirq_pending))
+		return;
+
+	curr = current_task();
+	if (curr && curr->fiber) {
+		__wake_ksoftirqd();
+		return;
+	}
+
+	__do_softirq();
+}
+
+static void ksoftirqd_thread(__unused void *arg)
+{
+	while (1) {
+		irq_disable();
+		if (!this_cpu_read(softirq_pending)) {
+			current_task()->state = TASK_BLOCKED;
+			schedule(1);
+		}
+		irq_enable();
+
+		__do_softirq();
+	}
+}
+
+/*
+ * __tasklet_state_update:
+ * Atomically clear bits `clear` and set bits `set` in the state of
+ * tasklet `t`. Returns the previous state.
+ */
+static unsigned long __tasklet_state_update(struct tasklet *t,
+                                            unsigned long clear,
+                                            unsigned long set)
+{
+	unsigned long old;
+
+	do {
+		old = t->state;
+	} while (atomic_cmpxchg(&t->state, old, (old & ~clear) | set) != old);
+
+	return old;
+}
+
+static void __tasklet_list_add(struct tasklet_list *list, struct tasklet *t)
+{
+	t->next = NULL;
+	if (list->head)
+		list->tail->next = t;
+	else
+		list->head = t;
+	list->tail = t;
+}
+
+static void __tasklet_schedule(struct tasklet *t,
+                               struct tasklet_list *list, int nr)
+{
+	unsigned long irqstate;
+
+	if (__tasklet_state_update(t, 0, TASKLET_SCHED) & TASKLET_SCHED)
+		return;
+
+	irq_save(irqstate);
+	__tasklet_list_add(this_cpu_ptr(list), t);
+	__raise_softirq(nr);
+	if (!in_irq())
+		__wake_ksoftirqd();
+	irq_restore(irqstate);
+}
+
+/*
+ * tasklet_schedule:
+ * Schedule tasklet `t` to run on the current CPU. A tasklet which is
+ * already scheduled is not scheduled again. A tasklet never runs on
+ * multiple CPUs at once.
+ */
+void tasklet_schedule(struct tasklet *t)
+{
+	__tasklet_schedule(t, &tasklet_vec, SOFTIRQ_TASKLET);
+}
+
+/* tasklet_hi_schedule: schedule `t` to run before all normal tasklets */
+void tasklet_hi_schedule(struct tasklet *t)
+{
+	__tasklet_schedule(t, &tasklet_hi_vec, SOFTIRQ_HI);
+}
+
+void tasklet_init(struct tasklet *t, void (*func)(void *), void *data)
+{
+	t->next = NULL;
+	t->state = 0;
+	t->func = func;
+	t->data = data;
+}
+
+static void __tasklet_action(struct tasklet_list *vec, int nr)
+{
+	struct tasklet_list *list;
+	struct tasklet *t, *next;
+
+	list = this_cpu_ptr(vec);
+
+	irq_disable();
+	t = list->head;
+	list->head = NULL;
+	irq_enable();
+
+	for (; t; t = next) {
+		next = t->next;
+
+		if (__tasklet_state_update(t, 0, TASKLET_RUN) & TASKLET_RUN) {
+			/* running on another CPU; try again later */
+			irq_disable();
+			__tasklet_list_add(list, t);
+			__raise_softirq(nr);
+			irq_enable();
+			continue;
+		}
+
+		__tasklet_state_update(t, TASKLET_SCHED, 0);
+		t->func(t->data);
+		__tasklet_state_update(t, TASKLET_RUN, 0);
+	}
+}
+
+static void tasklet_action(void)
+{
+	__tasklet_action(&tasklet_vec, SOFTIRQ_TASKLET);
+}
+
+static void tasklet_hi_action(void)
+{
+	__tasklet_action(&tasklet_hi_vec, SOFTIRQ_HI);
+}
+
+/*
+ * softirq_init:
+ * Register the tasklet softirqs and start a ksoftirqd thread on each
+ * online CPU.
+ */
+void softirq_init(void)
+{
+	struct task *t;
+	int cpu;
+
+	open_softirq(SOFTIRQ_HI, tasklet_hi_action);
+	open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+
+	for_each_cpu(cpu, cpumask_online()) {
+		t = kthread_create(ksoftirqd_thread, NULL, 0,
+		                   "ksoftirqd/%d", cpu);
+		if (IS_ERR(t))
+			panic("could not create ksoftirqd for cpu %d: %s\n",
+			      cpu, strerror(ERR_VAL(t)));
+
+		t->cpu_restrict = CPUMASK_CPU(cpu);
+		cpu_var(ksoftirqd, cpu) = t;
+		kthread_start(t);
+	}
+}
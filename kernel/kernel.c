@@ -25,10 +25,13 @@
 #include <radix/mm.h>
 #include <radix/multiboot.h>
 #include <radix/percpu.h>
+#include <radix/sched.h>
 #include <radix/smp.h>
+#include <radix/softirq.h>
 #include <radix/tasking.h>
 #include <radix/version.h>
 #include <radix/vmm.h>
+#include <radix/workqueue.h>
 
 #include "mm/slab.h"
 
@@ -51,6 +54,10 @@ int kmain(struct multiboot_info *mbt)
 	irq_enable();
 
 	smp_init();
+	workqueue_init();
+	page_reclaim_enable();
+	softirq_init();
+	sched_bench();
 
 	/* temporary stuff below */
 	extern void kbd_install(void);
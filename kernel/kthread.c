@@ -17,18 +17,43 @@
  */
 
 #include <radix/bits.h>
+#include <radix/fpu.h>
 #include <radix/irq.h>
 #include <radix/kthread.h>
 #include <radix/mm.h>
+#include <radix/preempt.h>
 #include <radix/sched.h>
 #include <radix/slab.h>
+#include <radix/smp.h>
 #include <radix/tasking.h>
+#include <radix/workqueue.h>
 
 #include <rlibc/stdio.h>
 
+/*
+ * Each CPU keeps a few freed kernel stacks of small orders around to be
+ * reused by the next threads it creates, without going to the page
+ * allocator. The caches are only used from task context, so disabling
+ * preemption is enough to protect them.
+ */
+#define KSTACK_CACHE_ORDERS     3
+#define KSTACK_CACHE_SIZE       4
+
+struct kstack_cache {
+	int             count;
+	struct page     *stacks[KSTACK_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct kstack_cache, kstack_cache[KSTACK_CACHE_ORDERS]);
+
+/* exited threads waiting to be freed, linked through their wake_next */
+static DEFINE_PER_CPU(struct task *, zombie_tasks) = NULL;
+static DEFINE_PER_CPU(struct work, reap_work);
+
 static struct task *__kthread_create(void (*func)(void *), void *arg,
                                      int page_order);
 static void kthread_set_name(struct task *thread, char *name, va_list ap);
+static void kthread_reap(struct work *w);
 
 /*
  * kthread_create:
@@ -90,26 +115,116 @@ void kthread_start(struct task *thread)
 __noreturn void kthread_exit(void)
 {
 	struct task *thread;
-	char **s;
+	struct work *reaper;
 
 	irq_disable();
 	thread = current_task();
+	sched_del(thread);
+	fpu_task_exit(thread);
+	thread->state = TASK_ZOMBIE;
+
 	/*
-	 * TODO: the stack shouldn't be freed yet, as the following code is
-	 * still using it. A job should be created to free it at a later time.
+	 * The thread is still running on its stack, so it cannot be freed
+	 * here. It is handed to a reaper on this CPU instead, which can only
+	 * run once the thread has switched away for the last time.
 	 */
-	free_pages(thread->stack_base);
+	thread->wake_next = this_cpu_read(zombie_tasks);
+	this_cpu_write(zombie_tasks, thread);
 
-	for (s = thread->cmdline; *s; ++s)
-		kfree(s);
-	kfree(thread->cmdline);
+	reaper = this_cpu_ptr(&reap_work);
+	if (!reaper->func)
+		work_init(reaper, kthread_reap);
+	queue_work(reaper);
 
-	task_free(thread);
 	this_cpu_write(current_task, NULL);
 	schedule(1);
 	__builtin_unreachable();
 }
 
+/*
+ * kstack_alloc:
+ * Allocate a kernel stack of `2^order` pages,
+ * from the current CPU's cache if possible.
+ */
+static struct page *kstack_alloc(int order)
+{
+	struct kstack_cache *cache;
+	struct page *p;
+
+	if (order < KSTACK_CACHE_ORDERS) {
+		p = NULL;
+
+		cache = get_cpu_ptr(&kstack_cache[order]);
+		if (cache->count)
+			p = cache->stacks[--cache->count];
+		put_cpu_ptr(cache);
+
+		if (p)
+			return p;
+	}
+
+	return alloc_pages(PA_STANDARD, order);
+}
+
+/*
+ * kstack_free:
+ * Return the kernel stack beginning at `stack` to the current CPU's
+ * cache, or to the page allocator if the cache is full.
+ */
+static void kstack_free(void *stack)
+{
+	struct kstack_cache *cache;
+	struct page *p;
+	int order;
+
+	p = virt_to_page(stack);
+	order = PM_PAGE_BLOCK_ORDER(p);
+
+	if (order < KSTACK_CACHE_ORDERS) {
+		cache = get_cpu_ptr(&kstack_cache[order]);
+		if (cache->count < KSTACK_CACHE_SIZE) {
+			cache->stacks[cache->count++] = p;
+			p = NULL;
+		}
+		put_cpu_ptr(cache);
+
+		if (!p)
+			return;
+	}
+
+	free_pages(p);
+}
+
+/*
+ * kthread_reap:
+ * Free the stacks and task structures of all threads which have exited
+ * on the current CPU.
+ */
+static void kthread_reap(__unused struct work *w)
+{
+	struct task *thread, *next;
+	unsigned long irqstate;
+	char **cmdline, **s;
+
+	irq_save(irqstate);
+	thread = this_cpu_read(zombie_tasks);
+	this_cpu_write(zombie_tasks, NULL);
+	irq_restore(irqstate);
+
+	for (; thread; thread = next) {
+		next = thread->wake_next;
+		cmdline = thread->cmdline;
+
+		/* remove the task from the task list before its name goes */
+		kstack_free(thread->stack_base);
+		task_free(thread);
+
+		for (s = cmdline; *s; ++s)
+			kfree(*s);
+		kfree(cmdline);
+	}
+}
+
 static struct task *__kthread_create(void (*func)(void *), void *arg,
                                      int page_order)
 {
@@ -121,15 +236,16 @@ static struct task *__kthread_create(void (*func)(void *), void *arg,
 	if (IS_ERR(thread))
 		return thread;
 
-	p = alloc_pages(PA_STANDARD, page_order);
+	p = kstack_alloc(page_order);
 	if (IS_ERR(p)) {
 		task_free(thread);
 		return (void *)p;
 	}
 
-	stack_top = (addr_t)p->mem + pow2(page_order) * PAGE_SIZE;
+	stack_top = (addr_t)page_address(p) + pow2(page_order) * PAGE_SIZE;
 	kthread_reg_setup(&thread->regs, stack_top, (addr_t)func, (addr_t)arg);
-	thread->stack_base = p->mem;
+	thread->stack_base = page_address(p);
+	thread->cpu_restrict = CPUMASK_ALL;
 
 	return thread;
 }
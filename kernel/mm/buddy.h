@@ -32,12 +32,26 @@
 	.lock = SPINLOCK_INIT   \
 }
 
+/*
+ * Free page watermarks of a zone. Allocations first try to keep every zone
+ * above its low watermark, then above its min watermark, before taking
+ * whatever is left. Dropping below the low watermark starts background
+ * reclaim; pages are only zeroed ahead of time above the high watermark.
+ */
+enum {
+	WMARK_MIN,
+	WMARK_LOW,
+	WMARK_HIGH,
+	NR_WMARKS
+};
+
 struct buddy {
 	struct list     ord[PA_ORDERS];         /* lists of 2^i size blocks */
 	size_t          len[PA_ORDERS];         /* length of each list */
 	size_t          max_ord;                /* maximum available order */
 	size_t          total_pages;            /* total pages in this zone */
 	size_t          alloc_pages;            /* number of allocated pages */
+	size_t          wmark[NR_WMARKS];       /* free page watermarks */
 	spinlock_t      lock;
 };
 
@@ -17,10 +17,15 @@
  */
 
 #include <radix/bits.h>
+#include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/mm.h>
+#include <radix/percpu.h>
+#include <radix/shrinker.h>
+#include <radix/spinlock.h>
 #include <radix/vmm.h>
+#include <radix/workqueue.h>
 
 #include <rlibc/string.h>
 
@@ -40,6 +45,63 @@ static struct buddy zone_usr = BUDDY_INIT;
 
 #define __PA_UNMAPPABLE (1 << 31)
 
+/*
+ * Zones to try for each type of allocation, in order. Each zone is used
+ * down to its min watermark before falling back to the next, so the DMA
+ * zone is only used by other allocations as a last resort.
+ */
+static struct buddy *const zones_reg[] = { &zone_reg, &zone_dma, NULL };
+static struct buddy *const zones_usr[] = { &zone_usr, &zone_reg, &zone_dma, NULL };
+static struct buddy *const zones_dma[] = { &zone_dma, NULL };
+static struct buddy *const zones_low[] = { &zone_low, NULL };
+
+/*
+ * Each CPU caches small free blocks of the regular and user zones so that
+ * most single page allocations and frees don't touch the zone locks. A
+ * cache is refilled from its zone, or drained back to it, `batch` blocks
+ * at a time when it runs empty or grows past `high` blocks.
+ *
+ * Cached blocks are still marked allocated, so the buddy allocator never
+ * tries to coalesce them.
+ */
+#define PCP_ORDERS      2
+#define PCP_ZONE_REG    0
+#define PCP_ZONE_USR    1
+#define PCP_ZONES       2
+
+struct pcp_list {
+	struct list     blocks;
+	unsigned int    count;
+};
+
+static const unsigned int pcp_high[PCP_ORDERS] = { 64, 16 };
+static const unsigned int pcp_batch[PCP_ORDERS] = { 16, 4 };
+
+static DEFINE_PER_CPU(struct pcp_list, pcp_lists[PCP_ZONES][PCP_ORDERS]);
+
+/* the caches are only used once every CPU has its own per-CPU area */
+static int pcp_enabled = 0;
+
+/*
+ * Mapped, zeroed order-0 pages from the regular zone, filled in the
+ * background while the zone is above its high watermark and handed to
+ * __PA_ZERO allocations. The pool is emptied by reclaim.
+ */
+#define ZERO_POOL_SIZE  32
+
+static struct list zero_pool = LIST_INIT(zero_pool);
+static unsigned int zero_pool_count = 0;
+static spinlock_t zero_pool_lock = SPINLOCK_INIT;
+
+static void page_reclaim(struct work *w);
+static void zero_pool_fill(struct work *w);
+
+static DEFINE_WORK(reclaim_work, page_reclaim);
+static DEFINE_WORK(zero_work, zero_pool_fill);
+
+/* background work can only be queued once workqueues are running */
+static int reclaim_enabled = 0;
+
 /* total amount of usable memory in the system */
 static uint64_t memsize = 0;
 static uint64_t memused = 0;
@@ -47,10 +109,44 @@ static uint64_t memused = 0;
 static uint64_t phys_mem_end = 0;
 static uint64_t zone_reg_end = 0;
 
+/*
+ * Bit (pfn >> ord) of free_map[ord] is set when a free block of order `ord`
+ * starts at `pfn`. Blocks of an order never overlap, so the bits are unique.
+ * Checking whether a buddy can be coalesced only tests its bit, instead of
+ * reading its struct page. The maps follow the page map in memory.
+ */
+#define BITS_PER_LONG   (8 * sizeof (unsigned long))
+
+static unsigned long *free_map[PA_ORDERS];
+
+/* number of words in the free map of order `ord` covering `pfns` pages */
+#define FREE_MAP_WORDS(pfns, ord) (((pfns) >> (ord)) / BITS_PER_LONG + 1)
+
+static __always_inline int free_map_test(size_t ord, size_t pfn)
+{
+	pfn >>= ord;
+	return !!(free_map[ord][pfn / BITS_PER_LONG] &
+	          (1UL << (pfn % BITS_PER_LONG)));
+}
+
+static __always_inline void free_map_set(size_t ord, size_t pfn)
+{
+	pfn >>= ord;
+	free_map[ord][pfn / BITS_PER_LONG] |= 1UL << (pfn % BITS_PER_LONG);
+}
+
+static __always_inline void free_map_clear(size_t ord, size_t pfn)
+{
+	pfn >>= ord;
+	free_map[ord][pfn / BITS_PER_LONG] &= ~(1UL << (pfn % BITS_PER_LONG));
+}
+
 static int next_phys_region(struct multiboot_info *mbt,
                             uint64_t *base, uint64_t *len);
 static void init_region(uint64_t base, uint64_t len, unsigned int flags);
+static void free_map_init(void);
 static void buddy_populate(void);
+static void zone_set_watermarks(struct buddy *zone);
 
 uint64_t totalmem(void)
 {
@@ -93,6 +189,8 @@ void buddy_init(struct multiboot_info *mbt)
 	}
 	phys_mem_end = next;
 
+	free_map_init();
+
 	/*
 	 * The regular zone is the memory that is set aside for kernel usage.
 	 * It extends from the end of the DMA zone up to 1/8 of total memory,
@@ -113,13 +211,245 @@ void buddy_init(struct multiboot_info *mbt)
 	}
 
 	buddy_populate();
+
+	zone_set_watermarks(&zone_low);
+	zone_set_watermarks(&zone_dma);
+	zone_set_watermarks(&zone_reg);
+	zone_set_watermarks(&zone_usr);
+}
+
+/*
+ * zone_set_watermarks:
+ * Reserve 1/64 of `zone` below its min watermark, with the low and high
+ * watermarks at two and three times that.
+ */
+static void zone_set_watermarks(struct buddy *zone)
+{
+	size_t min;
+
+	min = zone->total_pages / 64;
+	zone->wmark[WMARK_MIN] = min;
+	zone->wmark[WMARK_LOW] = min * 2;
+	zone->wmark[WMARK_HIGH] = min * 3;
 }
 
-static struct page *__alloc_pages(struct buddy *zone,
-                                  unsigned int flags, size_t ord);
+static struct page *__buddy_take(struct buddy *zone, size_t ord);
+static void __buddy_free(struct buddy *zone, struct page *p, size_t ord);
+static struct page *__prepare_pages(struct buddy *zone, struct page *p,
+                                    unsigned int flags, size_t ord);
 static void buddy_split(struct buddy *zone, size_t req_ord);
 static struct page *buddy_coalesce(struct buddy *zone, struct page *p);
 
+static __always_inline size_t __zone_free(struct buddy *zone)
+{
+	return zone->total_pages - zone->alloc_pages;
+}
+
+/*
+ * __zone_can_alloc:
+ * Check if a block of order `ord` can be taken from `zone` while leaving
+ * at least `mark` pages free. The zone's lock must be held.
+ */
+static __always_inline int __zone_can_alloc(struct buddy *zone, size_t ord,
+                                            size_t mark)
+{
+	return ord <= zone->max_ord && __zone_free(zone) >= pow2(ord) + mark;
+}
+
+/*
+ * __pcp_list:
+ * Return the current CPU's cache of order `ord` blocks from `zone`,
+ * or NULL if such blocks are not cached. Interrupts must be disabled.
+ */
+static struct pcp_list *__pcp_list(struct buddy *zone, size_t ord)
+{
+	struct pcp_list *pcp;
+
+	if (!pcp_enabled || ord >= PCP_ORDERS)
+		return NULL;
+
+	if (zone == &zone_reg)
+		pcp = raw_cpu_ptr(&pcp_lists[PCP_ZONE_REG][ord]);
+	else if (zone == &zone_usr)
+		pcp = raw_cpu_ptr(&pcp_lists[PCP_ZONE_USR][ord]);
+	else
+		return NULL;
+
+	/* per-CPU areas are zeroed, which leaves the lists uninitialized */
+	if (unlikely(!pcp->blocks.next))
+		list_init(&pcp->blocks);
+
+	return pcp;
+}
+
+/*
+ * __pcp_refill:
+ * Move up to a batch of blocks from `zone` into `pcp`,
+ * leaving at least `mark` pages free in the zone.
+ */
+static void __pcp_refill(struct buddy *zone, struct pcp_list *pcp,
+                         size_t ord, size_t mark)
+{
+	struct page *p;
+	unsigned int i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < pcp_batch[ord] && __zone_can_alloc(zone, ord, mark);
+	     ++i) {
+		p = __buddy_take(zone, ord);
+		list_ins(&pcp->blocks, &p->list);
+		++pcp->count;
+	}
+	spin_unlock(&zone->lock);
+}
+
+/* __pcp_drain: return the `n` coldest blocks in `pcp` to `zone` */
+static void __pcp_drain(struct buddy *zone, struct pcp_list *pcp,
+                        size_t ord, unsigned int n)
+{
+	struct page *p;
+
+	spin_lock(&zone->lock);
+	while (n-- && pcp->count) {
+		p = list_last_entry(&pcp->blocks, struct page, list);
+		list_del(&p->list);
+		--pcp->count;
+		__buddy_free(zone, p, ord);
+	}
+	spin_unlock(&zone->lock);
+}
+
+/*
+ * page_cache_enable:
+ * Start caching free pages per CPU. Must not be called before the per-CPU
+ * areas have been set up, as the boot per-CPU section is copied into them.
+ */
+void page_cache_enable(void)
+{
+	pcp_enabled = 1;
+}
+
+/*
+ * page_reclaim_enable:
+ * Allow the page allocator to start background reclaim and page zeroing.
+ * Called once workqueues have been initialized.
+ */
+void page_reclaim_enable(void)
+{
+	reclaim_enabled = 1;
+}
+
+static void __kick_reclaim(void)
+{
+	if (reclaim_enabled)
+		queue_work(&reclaim_work);
+}
+
+/*
+ * __zero_pool_take:
+ * Take a zeroed page from the zero pool, if there is one,
+ * topping the pool up in the background when it runs low.
+ */
+static struct page *__zero_pool_take(void)
+{
+	struct page *p;
+	unsigned long irqstate;
+	unsigned int count;
+
+	p = NULL;
+
+	spin_lock_irq(&zero_pool_lock, &irqstate);
+	if (zero_pool_count) {
+		p = list_first_entry(&zero_pool, struct page, list);
+		list_del(&p->list);
+		--zero_pool_count;
+	}
+	count = zero_pool_count;
+	spin_unlock_irq(&zero_pool_lock, irqstate);
+
+	if (p) {
+		p->slab_cache = (void *)PAGE_UNINIT_MAGIC;
+		p->slab_desc = (void *)PAGE_UNINIT_MAGIC;
+	}
+
+	if (count < ZERO_POOL_SIZE / 2 && reclaim_enabled &&
+	    __zone_free(&zone_reg) > zone_reg.wmark[WMARK_HIGH])
+		queue_work(&zero_work);
+
+	return p;
+}
+
+/*
+ * __zone_alloc:
+ * Allocate a block of order `ord` from `zone`, through the current CPU's
+ * cache if the zone has one, leaving at least `mark` pages in the zone.
+ * Returns NULL if the zone cannot satisfy the allocation.
+ */
+static struct page *__zone_alloc(struct buddy *zone, size_t ord, size_t mark)
+{
+	struct pcp_list *pcp;
+	struct page *p;
+	unsigned long irqstate;
+
+	p = NULL;
+
+	irq_save(irqstate);
+	if ((pcp = __pcp_list(zone, ord))) {
+		if (!pcp->count)
+			__pcp_refill(zone, pcp, ord, mark);
+
+		if (pcp->count) {
+			p = list_first_entry(&pcp->blocks, struct page, list);
+			list_del(&p->list);
+			--pcp->count;
+		}
+		irq_restore(irqstate);
+		return p;
+	}
+	irq_restore(irqstate);
+
+	spin_lock(&zone->lock);
+	if (__zone_can_alloc(zone, ord, mark))
+		p = __buddy_take(zone, ord);
+	spin_unlock(&zone->lock);
+
+	return p;
+}
+
+/*
+ * Watermarks which allocations try to stay above in each zone, in order.
+ * The pages below the min watermark of every zone are kept in reserve for
+ * __PA_NOFAIL allocations, which take them once all zones are at min.
+ */
+static const int alloc_marks[] = { WMARK_LOW, WMARK_MIN };
+
+/*
+ * __alloc_zones:
+ * Return the list of zones to try for an allocation with `flags`,
+ * adding any flags the zones require, or NULL if `flags` are invalid.
+ */
+static struct buddy *const *__alloc_zones(unsigned int *flags)
+{
+	struct buddy *const *zones;
+
+	if (*flags & __PA_ZONE_DMA) {
+		zones = zones_dma;
+		*flags |= __PA_UNMAPPABLE;
+	} else if (*flags & __PA_ZONE_USR) {
+		zones = zones_usr;
+		*flags |= __PA_UNMAPPABLE;
+	} else if (*flags & __PA_ZONE_LOW) {
+		zones = zones_low;
+	} else {
+		zones = zones_reg;
+	}
+
+	if ((*flags & __PA_UNMAPPABLE) && !(*flags & __PA_NO_MAP))
+		return NULL;
+
+	return zones;
+}
+
 /*
  * alloc_pages:
  * Allocate a contiguous block of pages in memory.
@@ -127,75 +457,229 @@ static struct page *buddy_coalesce(struct buddy *zone, struct page *p);
  */
 struct page *alloc_pages(unsigned int flags, size_t ord)
 {
-	struct buddy *zone;
-	struct page *ret;
+	struct buddy *const *zones, *const *z;
+	struct page *p;
+	size_t i, mark;
 
 	if (ord > PA_MAX_ORDER)
 		return ERR_PTR(EINVAL);
 
-	if (flags & __PA_ZONE_DMA) {
-		zone = &zone_dma;
-		flags |= __PA_UNMAPPABLE;
-	} else if (flags & __PA_ZONE_USR) {
-		zone = &zone_usr;
-		flags |= __PA_UNMAPPABLE;
-	} else if (flags & __PA_ZONE_LOW) {
-		zone = &zone_low;
-	} else {
-		zone = &zone_reg;
+	if (!(zones = __alloc_zones(&flags)))
+		return ERR_PTR(EINVAL);
+
+	if (zones == zones_reg && ord == 0 &&
+	    (flags & (__PA_ZERO | __PA_READONLY)) == __PA_ZERO) {
+		if ((p = __zero_pool_take()))
+			return p;
 	}
 
-	if ((flags & __PA_UNMAPPABLE) && !(flags & __PA_NO_MAP))
-		return ERR_PTR(EINVAL);
+	for (z = zones; *z; ++z) {
+		for (i = 0; i < ARRAY_SIZE(alloc_marks); ++i) {
+			mark = (*z)->wmark[alloc_marks[i]];
+			if ((p = __zone_alloc(*z, ord, mark)))
+				goto found;
+
+			/* the zone is running low; start freeing memory */
+			__kick_reclaim();
+		}
+	}
+
+	if (flags & __PA_NOFAIL) {
+		for (z = zones; *z; ++z) {
+			if ((p = __zone_alloc(*z, ord, 0)))
+				goto found;
+		}
+	}
+
+	return ERR_PTR(ENOMEM);
 
+found:
+	if (__zone_free(*z) < (*z)->wmark[WMARK_LOW])
+		__kick_reclaim();
+
+	return __prepare_pages(*z, p, flags, ord);
+}
+
+/*
+ * __zone_alloc_bulk:
+ * Take up to `n` blocks of order `ord` from `zone` in a single hold of its
+ * lock, leaving at least `mark` pages in the zone, and prepare them as
+ * requested by `flags`. Returns the number of blocks stored in `pages`.
+ */
+static size_t __zone_alloc_bulk(struct buddy *zone, unsigned int flags,
+                                size_t ord, size_t n, struct page **pages,
+                                size_t mark)
+{
+	size_t i, count;
+
+	count = 0;
 	spin_lock(&zone->lock);
+	while (count < n && __zone_can_alloc(zone, ord, mark))
+		pages[count++] = __buddy_take(zone, ord);
+	spin_unlock(&zone->lock);
+
+	for (i = 0; i < count; ++i)
+		__prepare_pages(zone, pages[i], flags, ord);
 
-	/* TODO: if zone is full, allocate from another */
-	if (ord > zone->max_ord || zone->alloc_pages == zone->total_pages)
-		ret = ERR_PTR(ENOMEM);
+	if (__zone_free(zone) < zone->wmark[WMARK_LOW])
+		__kick_reclaim();
+
+	return count;
+}
+
+/*
+ * alloc_pages_bulk:
+ * Allocate `n` blocks of 2^{ord} pages, storing them in `pages`.
+ * As many blocks as possible are taken from a zone in a single hold of
+ * its lock, bypassing the per-CPU caches. Returns the number of blocks
+ * allocated, which is less than `n` if memory runs out.
+ */
+size_t alloc_pages_bulk(unsigned int flags, size_t ord,
+                        size_t n, struct page **pages)
+{
+	struct buddy *const *zones, *const *z;
+	size_t i, count;
+
+	if (ord > PA_MAX_ORDER)
+		return 0;
+
+	if (!(zones = __alloc_zones(&flags)))
+		return 0;
+
+	count = 0;
+	for (z = zones; *z && count < n; ++z) {
+		for (i = 0; i < ARRAY_SIZE(alloc_marks) && count < n; ++i) {
+			count += __zone_alloc_bulk(*z, flags, ord, n - count,
+			                           pages + count,
+			                           (*z)->wmark[alloc_marks[i]]);
+		}
+	}
+
+	if (flags & __PA_NOFAIL) {
+		for (z = zones; *z && count < n; ++z) {
+			count += __zone_alloc_bulk(*z, flags, ord, n - count,
+			                           pages + count, 0);
+		}
+	}
+
+	return count;
+}
+
+/* __page_zone: return the zone the allocated block at `p` came from */
+static struct buddy *__page_zone(struct page *p)
+{
+	if (page_to_phys(p) < MIB(1))
+		return &zone_low;
+	else if (page_to_phys(p) < MIB(16))
+		return &zone_dma;
+	else if (p->status & PM_PAGE_ZONE_USR)
+		return &zone_usr;
 	else
-		ret = __alloc_pages(zone, flags, ord);
+		return &zone_reg;
+}
 
-	spin_unlock(&zone->lock);
+/* __is_alloc_block: check if `p` is the start of an allocated block */
+static __always_inline int __is_alloc_block(struct page *p)
+{
+	return (p->status & PM_PAGE_ALLOCATED) &&
+	       PM_PAGE_BLOCK_ORDER(p) != PM_PAGE_ORDER_INNER;
+}
 
-	return ret;
+/*
+ * __free_prepare:
+ * Ready the allocated block at `p` to be returned to its zone,
+ * unmapping it if it was mapped outside of the direct map.
+ *
+ * Blocks given to a vmm_area are unmapped from the address at which they
+ * were mapped, whichever zone they came from. Blocks of the other zones
+ * stay in the direct map.
+ */
+static void __free_prepare(struct buddy *zone, struct page *p)
+{
+	if ((p->status & PM_PAGE_VMM) ||
+	    (zone == &zone_usr && (p->status & PM_PAGE_MAPPED))) {
+		unmap_pages((addr_t)p->mem, pow2(PM_PAGE_BLOCK_ORDER(p)));
+		p->mem = (void *)PAGE_UNINIT_MAGIC;
+		p->status &= ~PM_PAGE_VMM;
+		if (zone == &zone_usr)
+			p->status &= ~PM_PAGE_MAPPED;
+	}
 }
 
 /* free_pages: free the block of pages starting at `p` */
 void free_pages(struct page *p)
 {
+	struct pcp_list *pcp;
 	struct buddy *zone;
+	unsigned long irqstate;
 	size_t ord;
 
-	/* make sure p is the start of an allocated block */
-	if (!(p->status & PM_PAGE_ALLOCATED))
+	if (!__is_alloc_block(p))
 		return;
-	if (PM_PAGE_BLOCK_ORDER(p) == PM_PAGE_ORDER_INNER)
+
+	zone = __page_zone(p);
+	ord = PM_PAGE_BLOCK_ORDER(p);
+	__free_prepare(zone, p);
+
+	irq_save(irqstate);
+	if ((pcp = __pcp_list(zone, ord))) {
+		/* recently freed blocks are handed out first */
+		list_add(&pcp->blocks, &p->list);
+		if (++pcp->count > pcp_high[ord])
+			__pcp_drain(zone, pcp, ord, pcp_batch[ord]);
+		irq_restore(irqstate);
 		return;
+	}
+	irq_restore(irqstate);
 
+	spin_lock(&zone->lock);
+	__buddy_free(zone, p, ord);
+	spin_unlock(&zone->lock);
+}
 
-	p->slab_cache = (void *)PAGE_UNINIT_MAGIC;
-	p->slab_desc = (void *)PAGE_UNINIT_MAGIC;
-	p->status &= ~PM_PAGE_ALLOCATED;
-	ord = PM_PAGE_BLOCK_ORDER(p);
+/*
+ * free_pages_bulk:
+ * Free the `n` blocks of pages in `pages`, which may be of any order.
+ * Consecutive blocks from the same zone are freed in a single hold of
+ * its lock, bypassing the per-CPU caches.
+ */
+void free_pages_bulk(struct page **pages, size_t n)
+{
+	struct buddy *zone, *locked;
+	size_t i;
 
-	if (page_to_phys(p) < MIB(1)) {
-		zone = &zone_low;
-	} else if (page_to_phys(p) < MIB(16)) {
-		zone = &zone_dma;
-	} else if (p->status & PM_PAGE_ZONE_USR) {
-		zone = &zone_usr;
-		if (p->status & PM_PAGE_MAPPED) {
-			unmap_pages((addr_t)p->mem, ord);
-			p->mem = (void *)PAGE_UNINIT_MAGIC;
-			p->status &= ~PM_PAGE_MAPPED;
-		}
-	} else {
-		zone = &zone_reg;
+	/* unmapping can flush other CPUs' TLBs, so do it outside the locks */
+	for (i = 0; i < n; ++i) {
+		if (__is_alloc_block(pages[i]))
+			__free_prepare(__page_zone(pages[i]), pages[i]);
 	}
 
-	spin_lock(&zone->lock);
+	locked = NULL;
+	for (i = 0; i < n; ++i) {
+		if (!__is_alloc_block(pages[i]))
+			continue;
+
+		zone = __page_zone(pages[i]);
+		if (zone != locked) {
+			if (locked)
+				spin_unlock(&locked->lock);
+			spin_lock(&zone->lock);
+			locked = zone;
+		}
+		__buddy_free(zone, pages[i], PM_PAGE_BLOCK_ORDER(pages[i]));
+	}
+	if (locked)
+		spin_unlock(&locked->lock);
+}
 
+/*
+ * __buddy_free:
+ * Return the allocated block of 2^{ord} pages at `p` to `zone`.
+ * The zone's lock must be held.
+ */
+static void __buddy_free(struct buddy *zone, struct page *p, size_t ord)
+{
+	p->status &= ~PM_PAGE_ALLOCATED;
 	zone->alloc_pages -= pow2(ord);
 	memused -= pow2(ord) * PAGE_SIZE;
 
@@ -207,17 +691,18 @@ void free_pages(struct page *p)
 	list_add(&zone->ord[ord], &p->list);
 	zone->len[ord]++;
 	zone->max_ord = max(zone->max_ord, ord);
-
-	spin_unlock(&zone->lock);
+	free_map_set(ord, page_to_pfn(p));
 }
 
-/* __alloc_pages: allocate 2^{ord} pages from `zone` */
-static struct page *__alloc_pages(struct buddy *zone,
-                                  unsigned int flags, size_t ord)
+/*
+ * __buddy_take:
+ * Remove a free block of 2^{ord} pages from `zone`. The zone's lock must
+ * be held and the zone must have a block of the order available.
+ */
+static struct page *__buddy_take(struct buddy *zone, size_t ord)
 {
 	struct page *p;
-	addr_t virt;
-	int npages, prot;
+	int npages;
 
 	/* split larger blocks until one of the requested order exists */
 	if (!zone->len[ord])
@@ -226,6 +711,7 @@ static struct page *__alloc_pages(struct buddy *zone,
 	p = list_first_entry(&zone->ord[ord], struct page, list);
 	list_del(&p->list);
 	zone->len[ord]--;
+	free_map_clear(ord, page_to_pfn(p));
 	if (zone->max_ord && ord == zone->max_ord) {
 		while (!zone->len[zone->max_ord])
 			zone->max_ord--;
@@ -235,27 +721,162 @@ static struct page *__alloc_pages(struct buddy *zone,
 	zone->alloc_pages += npages;
 	memused += npages * PAGE_SIZE;
 
+	p->status |= PM_PAGE_ALLOCATED;
+	return p;
+}
+
+/*
+ * __prepare_pages:
+ * Map the newly allocated block of 2^{ord} pages at `p`, taken from
+ * `zone`, as requested by `flags`.
+ */
+static struct page *__prepare_pages(struct buddy *zone, struct page *p,
+                                    unsigned int flags, size_t ord)
+{
+	addr_t virt;
+	int npages, prot;
+
+	/* the block has just been taken off a list */
+	p->slab_cache = (void *)PAGE_UNINIT_MAGIC;
+	p->slab_desc = (void *)PAGE_UNINIT_MAGIC;
+
+	npages = pow2(ord);
 	if (!(flags & __PA_NO_MAP) && !(p->status & PM_PAGE_MAPPED)) {
-		if (zone == &zone_reg)
-			virt = phys_to_virt(page_to_phys(p));
-		else
+		/* only the user zone lies outside of the direct map */
+		if (zone == &zone_usr) {
 			virt = (addr_t)vmalloc(npages * PAGE_SIZE);
+			p->mem = (void *)virt;
+		} else {
+			virt = phys_to_virt(page_to_phys(p));
+		}
 
 		prot = flags & __PA_READONLY ? PROT_READ : PROT_WRITE;
 		map_pages_kernel(virt, page_to_phys(p), prot,
 		                 PAGE_CP_DEFAULT, npages);
 
-		if (flags & __PA_ZERO)
-			memset((void *)virt, 0, npages * PAGE_SIZE);
-
-		p->mem = (void *)virt;
 		p->status |= PM_PAGE_MAPPED;
 	}
 
-	p->status |= PM_PAGE_ALLOCATED;
+	/* freed pages stay mapped, so they have to be cleared every time */
+	if ((flags & __PA_ZERO) && (p->status & PM_PAGE_MAPPED))
+		memset(page_address(p), 0, npages * PAGE_SIZE);
+
 	return p;
 }
 
+/*
+ * __drain_local_pages:
+ * Return all blocks in the current CPU's page caches to their zones.
+ */
+static void __drain_local_pages(void)
+{
+	struct pcp_list *pcp;
+	unsigned long irqstate;
+	size_t ord;
+
+	irq_save(irqstate);
+	for (ord = 0; ord < PCP_ORDERS; ++ord) {
+		if ((pcp = __pcp_list(&zone_reg, ord)))
+			__pcp_drain(&zone_reg, pcp, ord, pcp->count);
+		if ((pcp = __pcp_list(&zone_usr, ord)))
+			__pcp_drain(&zone_usr, pcp, ord, pcp->count);
+	}
+	irq_restore(irqstate);
+}
+
+/*
+ * __reclaim_target:
+ * Return the number of pages which must be freed to bring every zone
+ * back up to its high watermark.
+ */
+static unsigned long __reclaim_target(void)
+{
+	static struct buddy *const zones[] = {
+		&zone_reg, &zone_usr, &zone_dma
+	};
+	unsigned long target;
+	size_t i, free;
+
+	target = 0;
+	for (i = 0; i < ARRAY_SIZE(zones); ++i) {
+		free = __zone_free(zones[i]);
+		if (free < zones[i]->wmark[WMARK_HIGH])
+			target += zones[i]->wmark[WMARK_HIGH] - free;
+	}
+
+	return target;
+}
+
+/*
+ * page_reclaim:
+ * Background work run when a zone drops below its low watermark.
+ * Releases the zero pool and the current CPU's page caches, then runs
+ * the registered shrinkers if the zones are still short of pages.
+ */
+static void page_reclaim(__unused struct work *w)
+{
+	struct list pool;
+	struct page *p;
+	unsigned long irqstate, target;
+
+	list_init(&pool);
+
+	spin_lock_irq(&zero_pool_lock, &irqstate);
+	if (zero_pool_count) {
+		/* move the whole pool over to the local list */
+		pool.next = zero_pool.next;
+		pool.prev = zero_pool.prev;
+		pool.next->prev = &pool;
+		pool.prev->next = &pool;
+		list_init(&zero_pool);
+		zero_pool_count = 0;
+	}
+	spin_unlock_irq(&zero_pool_lock, irqstate);
+
+	while (!list_empty(&pool)) {
+		p = list_first_entry(&pool, struct page, list);
+		list_del(&p->list);
+		free_pages(p);
+	}
+
+	__drain_local_pages();
+
+	if ((target = __reclaim_target()))
+		shrink_memory(target);
+}
+
+/*
+ * zero_pool_fill:
+ * Top up the zero pool while the regular zone has plenty of free pages.
+ */
+static void zero_pool_fill(__unused struct work *w)
+{
+	struct page *p;
+	unsigned long irqstate;
+	unsigned int count;
+
+	while (1) {
+		spin_lock_irq(&zero_pool_lock, &irqstate);
+		count = zero_pool_count;
+		spin_unlock_irq(&zero_pool_lock, irqstate);
+
+		if (count >= ZERO_POOL_SIZE ||
+		    __zone_free(&zone_reg) <= zone_reg.wmark[WMARK_HIGH])
+			break;
+
+		p = alloc_page(PA_STANDARD);
+		if (IS_ERR(p))
+			break;
+
+		memset(page_address(p), 0, PAGE_SIZE);
+
+		spin_lock_irq(&zero_pool_lock, &irqstate);
+		list_add(&zero_pool, &p->list);
+		++zero_pool_count;
+		spin_unlock_irq(&zero_pool_lock, irqstate);
+	}
+}
+
 /*
  * buddy_split:
  * Split a block of pages in `zone` to get a block of size `req_ord`.
@@ -278,6 +899,7 @@ static void buddy_split(struct buddy *zone, size_t req_ord)
 
 		list_del(&p->list);
 		zone->len[ord]--;
+		free_map_clear(ord, page_to_pfn(p));
 		--ord;
 
 		PM_SET_BLOCK_ORDER(p, ord);
@@ -285,6 +907,8 @@ static void buddy_split(struct buddy *zone, size_t req_ord)
 		list_add(&zone->ord[ord], &buddy->list);
 		list_add(&zone->ord[ord], &p->list);
 		zone->len[ord] += 2;
+		free_map_set(ord, page_to_pfn(buddy));
+		free_map_set(ord, page_to_pfn(p));
 	}
 }
 
@@ -298,45 +922,51 @@ static struct page *buddy_coalesce(struct buddy *zone, struct page *p)
 	size_t ord, block_off;
 	struct page *buddy;
 
-	do {
+	ord = PM_PAGE_BLOCK_ORDER(p);
+	while (ord < PM_PAGE_MAX_ORDER(p)) {
 		block_off = PM_PAGE_BLOCK_OFFSET(p);
-		ord = PM_PAGE_BLOCK_ORDER(p);
 		if (ALIGNED(block_off, pow2(ord + 1)))
 			buddy = p + pow2(ord);
 		else
 			buddy = p - pow2(ord);
 
-		/*
-		 * Two blocks can be coalesced if they are both
-		 * of the same order and both unallocated.
-		 */
-		if (PM_PAGE_BLOCK_ORDER(buddy) != PM_PAGE_BLOCK_ORDER(p))
-			return p;
-		if (buddy->status & PM_PAGE_ALLOCATED)
+		/* the buddy must be a free block of the same order */
+		if (!free_map_test(ord, page_to_pfn(buddy)))
 			return p;
 
 		list_del(&buddy->list);
 		zone->len[ord]--;
+		free_map_clear(ord, page_to_pfn(buddy));
 
 		/* set p to point to the base of the new, larger block */
 		if (p > buddy)
 			swap(p, buddy);
 
 		PM_SET_BLOCK_ORDER(buddy, PM_PAGE_ORDER_INNER);
-		PM_SET_BLOCK_ORDER(p, ord + 1);
-	} while (ord < PM_PAGE_MAX_ORDER(p));
+		buddy->slab_cache = (void *)PAGE_UNINIT_MAGIC;
+		buddy->slab_desc = (void *)PAGE_UNINIT_MAGIC;
+		PM_SET_BLOCK_ORDER(p, ++ord);
+	}
 
 	return p;
 }
 
 /*
  * mark_page_mapped:
- * Indicate that page `p` has been mapped to address `virt`.
+ * Indicate that page `p` has been mapped to address `virt`
+ * in a vmm_area, from which it is unmapped when it is freed.
  */
 void mark_page_mapped(struct page *p, addr_t virt)
 {
 	p->mem = (void *)virt;
-	p->status |= PM_PAGE_MAPPED;
+	p->status |= PM_PAGE_VMM;
+
+	/*
+	 * Pages in the other zones only count as mapped once they are in the
+	 * direct map, which is where page_address() finds them.
+	 */
+	if (p->status & PM_PAGE_ZONE_USR)
+		p->status |= PM_PAGE_MAPPED;
 	PM_SET_REFCOUNT(p, 1);
 }
 
@@ -450,11 +1080,10 @@ static void init_region(uint64_t base, uint64_t len, unsigned int flags)
 		for (; base < end; base += PAGE_SIZE) {
 			pfn = base >> PAGE_SHIFT;
 
+			page_map[pfn].status = PM_PAGE_ORDER_INNER | flags;
 			page_map[pfn].slab_cache = (void *)PAGE_UNINIT_MAGIC;
 			page_map[pfn].slab_desc = (void *)PAGE_UNINIT_MAGIC;
 			page_map[pfn].mem = (void *)PAGE_UNINIT_MAGIC;
-			page_map[pfn].status = PM_PAGE_ORDER_INNER | flags;
-			list_init(&page_map[pfn].list);
 
 			len -= PAGE_SIZE;
 		}
@@ -484,12 +1113,14 @@ static void check_table_space(size_t req_len)
 	}
 }
 
-/* check_space: ensure sufficient space in page map */
-static void check_space(size_t pfn, size_t pages)
+/*
+ * page_map_grow:
+ * Ensure that the first `req_len` bytes from PAGE_MAP_BASE are mapped.
+ */
+static void page_map_grow(size_t req_len)
 {
-	size_t req_len, off;
+	size_t off;
 
-	req_len = (pfn + pages) * sizeof (struct page);
 	off = npages * PAGE_SIZE;
 
 	/* check if pages need to be mapped */
@@ -506,6 +1137,40 @@ static void check_space(size_t pfn, size_t pages)
 	}
 }
 
+/* check_space: ensure sufficient space in page map */
+static void check_space(size_t pfn, size_t pages)
+{
+	page_map_grow((pfn + pages) * sizeof (struct page));
+}
+
+/*
+ * free_map_init:
+ * Place the buddy free maps after the last page of the page map,
+ * covering every page it describes. Must be called before the page map
+ * is reserved in buddy_populate.
+ */
+static void free_map_init(void)
+{
+	size_t ord, pfns, off, words;
+	unsigned long *map;
+
+	pfns = npages * PAGE_SIZE / sizeof (struct page);
+	off = npages * PAGE_SIZE;
+
+	words = 0;
+	for (ord = 0; ord < PA_ORDERS; ++ord)
+		words += FREE_MAP_WORDS(pfns, ord);
+
+	page_map_grow(off + words * sizeof *map);
+	map = (unsigned long *)(PAGE_MAP_BASE + off);
+	memset(map, 0, words * sizeof *map);
+
+	for (ord = 0; ord < PA_ORDERS; ++ord) {
+		free_map[ord] = map;
+		map += FREE_MAP_WORDS(pfns, ord);
+	}
+}
+
 static size_t zone_init(size_t pfn, size_t section_end,
                         struct buddy *zone, unsigned int flags);
 
@@ -590,6 +1255,7 @@ static size_t zone_init(size_t pfn, size_t section_end,
 			if (zone) {
 				list_add(&zone->ord[ord], &page_map[pfn].list);
 				zone->len[ord]++;
+				free_map_set(ord, pfn);
 				zone->max_ord = max(ord, zone->max_ord);
 				zone->total_pages += pow2(ord);
 			}
@@ -599,10 +1265,6 @@ static size_t zone_init(size_t pfn, size_t section_end,
 		start = pfn;
 		for (; pfn < end; ++pfn) {
 			page_map[pfn].status |= flags;
-			if (flags & PM_PAGE_MAPPED)
-				page_map[pfn].mem =
-					(void *)phys_to_virt(pfn << PAGE_SHIFT);
-
 			PM_SET_MAX_ORDER(page_map + pfn, ord);
 			PM_SET_PAGE_OFFSET(page_map + pfn, pfn - start);
 		}
@@ -0,0 +1,76 @@
+/*
+ * kernel/mm/shrinker.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/compiler.h>
+#include <radix/error.h>
+#include <radix/mutex.h>
+#include <radix/shrinker.h>
+
+/*
+ * Shrinkers are run newest first. The slab shrinker is registered at boot,
+ * so it runs last and can release slabs emptied by the others.
+ */
+static struct list shrinkers = LIST_INIT(shrinkers);
+static struct mutex shrinker_lock = MUTEX_INIT(shrinker_lock);
+
+/*
+ * register_shrinker:
+ * Add shrinker `s` to the list of shrinkers run on memory pressure.
+ */
+int register_shrinker(struct shrinker *s)
+{
+	if (unlikely(!s || !s->shrink))
+		return EINVAL;
+
+	mutex_lock(&shrinker_lock);
+	list_add(&shrinkers, &s->list);
+	mutex_unlock(&shrinker_lock);
+
+	return 0;
+}
+
+/* unregister_shrinker: stop running shrinker `s` */
+void unregister_shrinker(struct shrinker *s)
+{
+	mutex_lock(&shrinker_lock);
+	list_del(&s->list);
+	mutex_unlock(&shrinker_lock);
+}
+
+/*
+ * shrink_memory:
+ * Run registered shrinkers until `nr_pages` pages have been freed
+ * or all of them have run. Return the number of pages freed.
+ */
+unsigned long shrink_memory(unsigned long nr_pages)
+{
+	struct shrinker *s;
+	unsigned long freed;
+
+	freed = 0;
+
+	mutex_lock(&shrinker_lock);
+	list_for_each_entry(s, &shrinkers, list) {
+		if (freed >= nr_pages)
+			break;
+		freed += s->shrink(s, nr_pages - freed);
+	}
+	mutex_unlock(&shrinker_lock);
+
+	return freed;
+}
@@ -20,10 +20,14 @@
 #include <radix/bootmsg.h>
 #include <radix/compiler.h>
 #include <radix/cpu.h>
+#include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/mm.h>
+#include <radix/mutex.h>
+#include <radix/shrinker.h>
 #include <radix/slab.h>
+#include <radix/smp.h>
 
 #include <rlibc/stdio.h>
 #include <rlibc/string.h>
@@ -31,6 +35,8 @@
 #include "slab.h"
 
 struct list slab_caches;
+/* held while shrinking caches, which may sleep */
+static struct mutex slab_caches_lock = MUTEX_INIT(slab_caches_lock);
 
 /* The cache cache caches caches. */
 static struct slab_cache cache_cache;
@@ -39,6 +45,16 @@ static void __init_cache(struct slab_cache *cache, const char *name,
                          size_t size, size_t align, unsigned long flags,
                          void (*ctor)(void *));
 static int __grow_cache_unlocked(struct slab_cache *cache);
+static void __depot_drain(struct slab_cache *cache);
+
+static unsigned long slab_shrink(struct shrinker *s, unsigned long nr_pages);
+
+static struct shrinker slab_shrinker = {
+	.shrink = slab_shrink
+};
+
+/* magazines are allocated with kmalloc, so they must wait for it */
+static int kmalloc_active = 0;
 
 /*
  * Slabs with objects less than this size
@@ -62,6 +78,8 @@ void slab_init(void)
 	__grow_cache_unlocked(&cache_cache);
 
 	kmalloc_init();
+
+	register_shrinker(&slab_shrinker);
 }
 
 static struct slab_desc *init_slab(struct slab_cache *cache);
@@ -92,7 +110,10 @@ struct slab_cache *create_cache(const char *name, size_t size,
 	}
 
 	__init_cache(cache, name, size, align, flags, ctor);
+
+	mutex_lock(&slab_caches_lock);
 	list_ins(&slab_caches, &cache->list);
+	mutex_unlock(&slab_caches_lock);
 
 	return cache;
 }
@@ -104,6 +125,16 @@ struct slab_cache *create_cache(const char *name, size_t size,
 void destroy_cache(struct slab_cache *cache)
 {
 	struct list *l, *tmp;
+	size_t i;
+
+	/* objects in the magazines go down with their slabs */
+	for (i = 0; i < MAX_CPUS; ++i) {
+		if (cache->cpu_mags[i].loaded)
+			kfree(cache->cpu_mags[i].loaded);
+		if (cache->cpu_mags[i].prev)
+			kfree(cache->cpu_mags[i].prev);
+	}
+	__depot_drain(cache);
 
 	list_for_each_safe(l, tmp, &cache->full_slabs) {
 		destroy_slab(cache, list_entry(l, struct slab_desc, list));
@@ -118,25 +149,226 @@ void destroy_cache(struct slab_cache *cache)
 		list_del(l);
 	}
 
+	mutex_lock(&slab_caches_lock);
 	list_del(&cache->list);
+	mutex_unlock(&slab_caches_lock);
+
 	free_cache(&cache_cache, cache);
 }
 
 #define FREE_OBJ_ARR(s) ((uint16_t *)(s + 1))
 
+static __always_inline int __mag_has_rounds(struct slab_magazine *m)
+{
+	return m && m->rounds;
+}
+
+static __always_inline int __mag_has_room(struct slab_magazine *m)
+{
+	return m && m->rounds < m->size;
+}
+
 /*
- * alloc_cache:
- * Allocates a single object from the given cache.
+ * __mag_alloc:
+ * Take an object from the magazines of CPU `c`, exchanging an empty
+ * magazine for a full one from the depot if both have run out.
+ * Return NULL if there are no objects left. Interrupts must be disabled.
  */
-void *alloc_cache(struct slab_cache *cache)
+static void *__mag_alloc(struct slab_cache *cache, struct slab_cpu *c)
+{
+	struct slab_magazine *m;
+
+	if (!__mag_has_rounds(c->loaded)) {
+		if (__mag_has_rounds(c->prev)) {
+			swap(c->loaded, c->prev);
+		} else {
+			spin_lock(&cache->depot_lock);
+			if (list_empty(&cache->depot_full)) {
+				spin_unlock(&cache->depot_lock);
+				return NULL;
+			}
+			m = list_first_entry(&cache->depot_full,
+			                     struct slab_magazine, list);
+			list_del(&m->list);
+			if (c->prev)
+				list_add(&cache->depot_empty, &c->prev->list);
+			c->prev = c->loaded;
+			c->loaded = m;
+			spin_unlock(&cache->depot_lock);
+		}
+	}
+
+	return c->loaded->objs[--c->loaded->rounds];
+}
+
+/*
+ * __mag_free:
+ * Put `obj` into the magazines of CPU `c`, exchanging a full magazine
+ * for an empty one from the depot if both are full.
+ * Return 0 if there is no room for the object. Interrupts must be disabled.
+ */
+static int __mag_free(struct slab_cache *cache, struct slab_cpu *c, void *obj)
+{
+	struct slab_magazine *m;
+
+	if (!__mag_has_room(c->loaded)) {
+		if (__mag_has_room(c->prev)) {
+			swap(c->loaded, c->prev);
+		} else {
+			spin_lock(&cache->depot_lock);
+			if (list_empty(&cache->depot_empty)) {
+				spin_unlock(&cache->depot_lock);
+				return 0;
+			}
+			m = list_first_entry(&cache->depot_empty,
+			                     struct slab_magazine, list);
+			list_del(&m->list);
+			if (c->prev)
+				list_add(&cache->depot_full, &c->prev->list);
+			c->prev = c->loaded;
+			c->loaded = m;
+			spin_unlock(&cache->depot_lock);
+		}
+	}
+
+	c->loaded->objs[c->loaded->rounds++] = obj;
+	return 1;
+}
+
+/*
+ * __depot_add_empty:
+ * Allocate a new empty magazine for `cache` and put it in the depot.
+ * Return 0 if the cache does not use magazines or allocation fails.
+ */
+static int __depot_add_empty(struct slab_cache *cache)
+{
+	struct slab_magazine *m;
+	unsigned int size;
+	unsigned long irqstate;
+
+	size = cache->mag_size;
+	if (!kmalloc_active || !size)
+		return 0;
+
+	m = kmalloc(sizeof *m + size * sizeof (void *));
+	if (!m)
+		return 0;
+
+	m->size = size;
+	m->rounds = 0;
+
+	spin_lock_irq(&cache->depot_lock, &irqstate);
+	list_add(&cache->depot_empty, &m->list);
+	spin_unlock_irq(&cache->depot_lock, irqstate);
+
+	return 1;
+}
+
+static void __slab_free_unlocked(struct slab_cache *cache, void *obj);
+
+/*
+ * __cpu_mags:
+ * Return the current CPU's magazines for `cache`. If their size no longer
+ * matches the cache's magazine size, they are detached first and their
+ * objects returned to the slabs. The detached magazines are stored in
+ * `old`, to be released with __mags_release() once interrupts are enabled
+ * again. Interrupts must be disabled.
+ */
+static struct slab_cpu *__cpu_mags(struct slab_cache *cache,
+                                   struct slab_magazine **old)
+{
+	struct slab_magazine *m;
+	struct slab_cpu *c;
+	int i;
+
+	c = &cache->cpu_mags[processor_id()];
+	old[0] = old[1] = NULL;
+
+	if (likely((!c->loaded || c->loaded->size == cache->mag_size) &&
+	           (!c->prev || c->prev->size == cache->mag_size)))
+		return c;
+
+	old[0] = c->loaded;
+	old[1] = c->prev;
+	c->loaded = c->prev = NULL;
+
+	spin_lock(&cache->lock);
+	for (i = 0; i < 2; ++i) {
+		m = old[i];
+		while (m && m->rounds)
+			__slab_free_unlocked(cache, m->objs[--m->rounds]);
+	}
+	spin_unlock(&cache->lock);
+
+	return c;
+}
+
+/* __mags_release: free the magazines detached by __cpu_mags() */
+static __always_inline void __mags_release(struct slab_magazine **old)
+{
+	if (unlikely(old[0]))
+		kfree(old[0]);
+	if (unlikely(old[1]))
+		kfree(old[1]);
+}
+
+/*
+ * __depot_drain:
+ * Return the objects in all magazines in the depot of `cache`
+ * to their slabs and free the magazines.
+ */
+static void __depot_drain(struct slab_cache *cache)
+{
+	struct slab_magazine *m;
+	struct list full, empty;
+	unsigned long irqstate;
+
+	list_init(&full);
+	list_init(&empty);
+
+	spin_lock_irq(&cache->depot_lock, &irqstate);
+	while (!list_empty(&cache->depot_full)) {
+		m = list_first_entry(&cache->depot_full,
+		                     struct slab_magazine, list);
+		list_del(&m->list);
+		list_add(&full, &m->list);
+	}
+	while (!list_empty(&cache->depot_empty)) {
+		m = list_first_entry(&cache->depot_empty,
+		                     struct slab_magazine, list);
+		list_del(&m->list);
+		list_add(&empty, &m->list);
+	}
+	spin_unlock_irq(&cache->depot_lock, irqstate);
+
+	while (!list_empty(&full)) {
+		m = list_first_entry(&full, struct slab_magazine, list);
+		list_del(&m->list);
+
+		spin_lock(&cache->lock);
+		while (m->rounds)
+			__slab_free_unlocked(cache, m->objs[--m->rounds]);
+		spin_unlock(&cache->lock);
+
+		kfree(m);
+	}
+	while (!list_empty(&empty)) {
+		m = list_first_entry(&empty, struct slab_magazine, list);
+		list_del(&m->list);
+		kfree(m);
+	}
+}
+
+/*
+ * __slab_alloc:
+ * Allocate an object directly from the slabs of the given cache.
+ */
+static void *__slab_alloc(struct slab_cache *cache)
 {
 	struct slab_desc *s;
 	void *obj;
 	int err;
 
-	if (unlikely(!cache))
-		return ERR_PTR(EINVAL);
-
 	spin_lock(&cache->lock);
 	if (list_empty(&cache->partial_slabs)) {
 		/* grow the cache if no space exists */
@@ -171,51 +403,108 @@ out_unlock:
 	return obj;
 }
 
+/*
+ * __slab_free_unlocked:
+ * Return a valid object to its slab. The cache's lock must be held.
+ */
+static void __slab_free_unlocked(struct slab_cache *cache, void *obj)
+{
+	struct slab_desc *s;
+	long ind;
+
+	s = virt_to_page(obj)->slab_desc;
+	ind = (obj - s->first) / cache->offset;
+
+	/* update s->next to the index of the freed object */
+	FREE_OBJ_ARR(s)[ind] = s->next;
+	s->next = ind;
+
+	if (s->in_use == cache->count) {
+		/* slab was full; move to partial */
+		list_del(&s->list);
+		list_add(&cache->partial_slabs, &s->list);
+	} else if (s->in_use == 1) {
+		/* slab is now empty */
+		list_del(&s->list);
+		list_add(&cache->free_slabs, &s->list);
+	}
+	s->in_use--;
+}
+
+/*
+ * alloc_cache:
+ * Allocates a single object from the given cache.
+ */
+void *alloc_cache(struct slab_cache *cache)
+{
+	struct slab_magazine *old[2];
+	unsigned long irqstate;
+	void *obj;
+
+	if (unlikely(!cache))
+		return ERR_PTR(EINVAL);
+
+	irq_save(irqstate);
+	obj = __mag_alloc(cache, __cpu_mags(cache, old));
+	irq_restore(irqstate);
+	__mags_release(old);
+
+	if (obj)
+		return obj;
+
+	return __slab_alloc(cache);
+}
+
 /*
  * free_cache:
  * Free an object from the given cache.
  */
 void free_cache(struct slab_cache *cache, void *obj)
 {
+	struct slab_magazine *old[2];
 	struct slab_desc *s;
-	long diff, ind;
+	struct page *p;
+	unsigned long irqstate;
+	long diff;
+	int cached;
 
 	if (unlikely(!cache || !obj))
 		return;
 
-	s = virt_to_page(obj)->slab_desc;
-	if (unlikely((uintptr_t)s == PAGE_UNINIT_MAGIC)) {
+	p = virt_to_page(obj);
+	if (unlikely(!(p->status & PM_PAGE_SLAB))) {
 		klog(KLOG_ERROR,
 		     "free_cache: attempt to free non-allocated address %p\n",
 		     obj);
 		return;
 	}
+	s = p->slab_desc;
 
 	diff = obj - s->first;
 	if (unlikely(!ALIGNED(diff, cache->offset) || diff < 0))
 		return;
-	ind = diff / cache->offset;
 
 	if (cache->ctor)
 		cache->ctor(obj);
 
-	spin_lock(&cache->lock);
-
-	/* update s->next to the index of the freed object */
-	FREE_OBJ_ARR(s)[ind] = s->next;
-	s->next = ind;
-
-	if (s->in_use == cache->count) {
-		/* slab was full; move to partial */
-		list_del(&s->list);
-		list_add(&cache->partial_slabs, &s->list);
-	} else if (s->in_use == 1) {
-		/* slab is now empty */
-		list_del(&s->list);
-		list_add(&cache->free_slabs, &s->list);
+	irq_save(irqstate);
+	cached = __mag_free(cache, __cpu_mags(cache, old), obj);
+	irq_restore(irqstate);
+	__mags_release(old);
+
+	/* the depot ran out of empty magazines; give it another one */
+	if (!cached && __depot_add_empty(cache)) {
+		irq_save(irqstate);
+		cached = __mag_free(cache, &cache->cpu_mags[processor_id()],
+		                    obj);
+		irq_restore(irqstate);
 	}
-	s->in_use--;
 
+	if (cached)
+		return;
+
+	spin_lock(&cache->lock);
+	__slab_free_unlocked(cache, obj);
 	spin_unlock(&cache->lock);
 }
 
@@ -282,6 +571,9 @@ int shrink_cache(struct slab_cache *cache)
 	if (unlikely(!cache))
 		return 0;
 
+	/* empty the depot first so that more slabs can be released */
+	__depot_drain(cache);
+
 	spin_lock(&cache->lock);
 	ret = __shrink_cache_unlocked(cache);
 	spin_unlock(&cache->lock);
@@ -289,6 +581,68 @@ int shrink_cache(struct slab_cache *cache)
 	return ret;
 }
 
+/*
+ * set_cache_magazine_size:
+ * Set the number of objects held by each magazine of the given cache,
+ * or disable magazines if `size` is 0. The depot is emptied immediately.
+ * Each CPU releases its own magazines of the old size the next time it
+ * allocates or frees an object from the cache.
+ */
+int set_cache_magazine_size(struct slab_cache *cache, unsigned int size)
+{
+	if (unlikely(!cache || size > SLAB_MAG_MAX))
+		return EINVAL;
+
+	cache->mag_size = size;
+	__depot_drain(cache);
+
+	return 0;
+}
+
+/*
+ * shrink_all_caches:
+ * Release the free slabs of every cache in the system.
+ * Return the number of pages freed.
+ */
+int shrink_all_caches(void)
+{
+	struct slab_cache *cache;
+	int n;
+
+	n = 0;
+
+	mutex_lock(&slab_caches_lock);
+	list_for_each_entry(cache, &slab_caches, list)
+		n += shrink_cache(cache);
+	mutex_unlock(&slab_caches_lock);
+
+	return n;
+}
+
+/*
+ * slab_shrink:
+ * Release free slabs from the caches in the system until
+ * `nr_pages` pages have been freed.
+ */
+static unsigned long slab_shrink(__unused struct shrinker *s,
+                                 unsigned long nr_pages)
+{
+	struct slab_cache *cache;
+	unsigned long n;
+
+	n = 0;
+
+	mutex_lock(&slab_caches_lock);
+	list_for_each_entry(cache, &slab_caches, list) {
+		n += shrink_cache(cache);
+		if (n >= nr_pages)
+			break;
+	}
+	mutex_unlock(&slab_caches_lock);
+
+	return n;
+}
+
 /*
  * init_slab:
  * Initialize a new slab and its objects from the given cache.
@@ -305,7 +659,7 @@ static struct slab_desc *init_slab(struct slab_cache *cache)
 		if (IS_ERR(p))
 			return (void *)p;
 
-		s = p->mem;
+		s = page_address(p);
 
 		/* first object placed directly after the free object array */
 		first = (uintptr_t)(s + 1) + cache->count * sizeof (uint16_t);
@@ -315,7 +669,7 @@ static struct slab_desc *init_slab(struct slab_cache *cache)
 		if (IS_ERR(p))
 			return (void *)p;
 		s = kmalloc(sizeof *s + cache->count * sizeof (uint16_t));
-		s->first = p->mem;
+		s->first = page_address(p);
 	}
 
 	list_init(&s->list);
@@ -331,8 +685,12 @@ static struct slab_desc *init_slab(struct slab_cache *cache)
 			cache->ctor(s->first + i * cache->offset);
 	}
 
-	p->slab_cache = cache;
-	p->slab_desc = s;
+	/* every page is tagged, as objects can lie on any of them */
+	for (i = 0; i < pow2(PM_PAGE_BLOCK_ORDER(p)); ++i) {
+		p[i].status |= PM_PAGE_SLAB;
+		p[i].slab_cache = cache;
+		p[i].slab_desc = s;
+	}
 
 	return s;
 }
@@ -344,17 +702,23 @@ static struct slab_desc *init_slab(struct slab_cache *cache)
 static int destroy_slab(struct slab_cache *cache, struct slab_desc *s)
 {
 	struct page *p;
-	int n;
+	int i, n;
 
 	if (cache->flags & SLAB_DESC_ON_SLAB) {
-		p = (struct page *)s;
+		p = virt_to_page(s);
 		n = 1;
 	} else {
-		p = s->first;
+		p = virt_to_page(s->first);
 		n = pow2(PM_PAGE_BLOCK_ORDER(p));
 		kfree(s);
 	}
 
+	for (i = 0; i < n; ++i) {
+		p[i].status &= ~PM_PAGE_SLAB;
+		p[i].slab_cache = (void *)PAGE_UNINIT_MAGIC;
+		p[i].slab_desc = (void *)PAGE_UNINIT_MAGIC;
+	}
+
 	free_pages(p);
 
 	return n;
@@ -413,10 +777,29 @@ static int calculate_count(size_t npages, size_t offset, unsigned long flags)
 	}
 }
 
+/*
+ * calculate_mag_size:
+ * Choose the default magazine size for a cache of objects of the given size.
+ * Small objects are allocated most often and are the cheapest to hold on to.
+ */
+static unsigned int calculate_mag_size(size_t size)
+{
+	if (size <= 64)
+		return 15;
+	else if (size <= 256)
+		return 7;
+	else if (size <= 1024)
+		return 3;
+	else
+		return 1;
+}
+
 static void __init_cache(struct slab_cache *cache, const char *name,
                          size_t size, size_t align, unsigned long flags,
                          void (*ctor)(void *))
 {
+	size_t i;
+
 	cache->objsize = size;
 	cache->align = calculate_align(flags, align, size);
 	cache->offset = ALIGN(size, cache->align);
@@ -437,6 +820,15 @@ static void __init_cache(struct slab_cache *cache, const char *name,
 	list_init(&cache->free_slabs);
 	list_init(&cache->list);
 
+	cache->mag_size = calculate_mag_size(size);
+	for (i = 0; i < MAX_CPUS; ++i) {
+		cache->cpu_mags[i].loaded = NULL;
+		cache->cpu_mags[i].prev = NULL;
+	}
+	spin_init(&cache->depot_lock);
+	list_init(&cache->depot_full);
+	list_init(&cache->depot_empty);
+
 	cache->cache_name[0] = '\0';
 	strncat(cache->cache_name, name, NAME_LEN - 1);
 }
@@ -451,8 +843,6 @@ static void __init_cache(struct slab_cache *cache, const char *name,
 static struct slab_cache *kmalloc_sm_caches[24];
 static struct slab_cache *kmalloc_lg_caches[6];
 
-static int kmalloc_active = 0;
-
 /*
  * kmalloc_init:
  * Initialize all caches used by kmalloc.
@@ -524,15 +914,15 @@ void *kmalloc(size_t size)
 
 void kfree(void *ptr)
 {
-	struct slab_cache *cache;
+	struct page *p;
 
-	cache = virt_to_page(ptr)->slab_cache;
-	if (unlikely((uintptr_t)cache == PAGE_UNINIT_MAGIC)) {
+	p = virt_to_page(ptr);
+	if (unlikely(!(p->status & PM_PAGE_SLAB))) {
 		klog(KLOG_ERROR,
 		     "kfree: attempt to free non-allocated address %p\n",
 		     ptr);
 		return;
 	}
 
-	free_cache(cache, ptr);
+	free_cache(p->slab_cache, ptr);
 }
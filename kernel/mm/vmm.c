@@ -64,6 +64,9 @@ struct vmm_block {
 
 #define VMM_ALLOCATED (1 << 0)
 
+/* number of page blocks allocated or freed in one go */
+#define VMM_PAGE_BATCH 16U
+
 #define vmm_block_alloc()       alloc_cache(vmm_block_cache)
 #define vmm_block_free(block)   free_cache(vmm_block_cache, block)
 
@@ -579,6 +582,7 @@ static __always_inline void __vmm_add_area_pages(struct vmm_block *block,
 {
 	if (!block->mapped) {
 		block->mapped = p;
+		list_init(&p->list);
 		if (block->area.size < PAGE_SIZE)
 			__vmm_small_set_mapped(block);
 	} else {
@@ -593,9 +597,9 @@ static __always_inline void __vmm_add_area_pages(struct vmm_block *block,
  */
 static void vmm_alloc_block_pages(struct vmm_block *block)
 {
-	struct page *p;
+	struct page *batch[VMM_PAGE_BATCH];
 	addr_t base, end;
-	size_t ord;
+	size_t ord, i, n, count;
 	int pages;
 
 	base = block->area.base;
@@ -604,22 +608,25 @@ static void vmm_alloc_block_pages(struct vmm_block *block)
 
 	while (base < end) {
 		ord = min(log2(pages), PA_MAX_ORDER);
+		n = min((size_t)pages >> ord, VMM_PAGE_BATCH);
+
+		count = alloc_pages_bulk(PA_USER, ord, n, batch);
+		for (i = 0; i < count; ++i) {
+			map_pages_kernel(base, page_to_phys(batch[i]), PROT_WRITE,
+			                 PAGE_CP_DEFAULT, pow2(ord));
+			mark_page_mapped(batch[i], base);
+			__vmm_add_area_pages(block, batch[i]);
+
+			pages -= pow2(ord);
+			base += pow2(ord) * PAGE_SIZE;
+		}
 
-		p = alloc_pages(PA_USER, ord);
 		/*
 		 * It's OK if this fails; there will be a second chance
 		 * when the page fault handler is hit.
 		 */
-		if (IS_ERR(p))
+		if (count < n)
 			return;
-
-		map_pages_kernel(base, page_to_phys(p), PROT_WRITE,
-		                 PAGE_CP_DEFAULT, pow2(ord));
-		mark_page_mapped(p, base);
-		__vmm_add_area_pages(block, p);
-
-		pages -= pow2(ord);
-		base += pow2(ord) * PAGE_SIZE;
 	}
 }
 
@@ -705,38 +712,50 @@ struct vmm_area *vmm_alloc_size(struct vmm_space *vmm, size_t size,
 		return __vmm_alloc_size(vmm, size, flags);
 }
 
-static void __vmm_free_pages(struct vmm_space *vmm, struct vmm_block *block)
+/*
+ * __vmm_release_pages:
+ * Free all physical pages mapped to `block`, returning how many there were.
+ */
+static size_t __vmm_release_pages(struct vmm_block *block)
 {
+	struct page *batch[VMM_PAGE_BATCH];
 	struct page *p;
+	size_t n, pages;
 
-	if (!block->mapped)
-		return;
-
+	n = pages = 0;
 	while (!list_empty(&block->mapped->list)) {
 		p = list_first_entry(&block->mapped->list, struct page, list);
-		vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(p));
 		list_del(&p->list);
-		free_pages(p);
+		pages += pow2(PM_PAGE_BLOCK_ORDER(p));
+
+		batch[n++] = p;
+		if (n == VMM_PAGE_BATCH) {
+			free_pages_bulk(batch, n);
+			n = 0;
+		}
 	}
-	vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(block->mapped));
-	free_pages(block->mapped);
+	pages += pow2(PM_PAGE_BLOCK_ORDER(block->mapped));
+	batch[n++] = block->mapped;
+	free_pages_bulk(batch, n);
 	block->mapped = NULL;
+
+	return pages;
 }
 
-static void __vmm_free_kernel_pages(struct vmm_block *block)
+static void __vmm_free_pages(struct vmm_space *vmm, struct vmm_block *block)
 {
-	struct page *p;
+	if (!block->mapped)
+		return;
+
+	vmm->pages -= __vmm_release_pages(block);
+}
 
+static void __vmm_free_kernel_pages(struct vmm_block *block)
+{
 	if (!block->mapped)
 		return;
 
-	while (!list_empty(&block->mapped->list)) {
-		p = list_first_entry(&block->mapped->list, struct page, list);
-		list_del(&p->list);
-		free_pages(p);
-	}
-	free_pages(block->mapped);
-	block->mapped = NULL;
+	__vmm_release_pages(block);
 }
 
 /*
@@ -22,6 +22,7 @@
 #include <radix/mutex.h>
 #include <radix/sched.h>
 #include <radix/tasking.h>
+#include <radix/wait.h>
 
 void mutex_init(struct mutex *m)
 {
@@ -34,38 +35,57 @@ void mutex_init(struct mutex *m)
  * mutex_lock:
  * Attempt to lock mutex `m`. If it is already locked,
  * put thread into a wait and yield CPU.
+ *
+ * Waiters are queued through a wait entry on their stack rather than
+ * their task's own list node, which belongs to the scheduler: a waiter
+ * may be preempted and requeued before it gets to switch out.
  */
 void mutex_lock(struct mutex *m)
 {
-	struct task *curr;
+	struct wait_entry w;
 	unsigned long irqstate;
 
+	w.task = current_task();
+	list_init(&w.list);
+
 	while (atomic_swap(&m->count, 1) != 0) {
-		curr = current_task();
 		/* if there is no current task, functions as a spinlock */
-		if (curr) {
-			curr->state = TASK_BLOCKED;
-			spin_lock_irq(&m->lock, &irqstate);
-			list_ins(&m->queue, &curr->queue);
-			spin_unlock_irq(&m->lock, irqstate);
+		if (!w.task)
+			continue;
+
+		spin_lock_irq(&m->lock, &irqstate);
+		if (list_empty(&w.list))
+			list_ins(&m->queue, &w.list);
+		w.task->state = TASK_BLOCKED;
+		spin_unlock_irq(&m->lock, irqstate);
+
+		/* the mutex may have been released before the task was queued */
+		if (m->count)
 			schedule(1);
-		}
+		w.task->state = TASK_RUNNING;
+	}
+
+	if (!list_empty(&w.list)) {
+		spin_lock_irq(&m->lock, &irqstate);
+		if (!list_empty(&w.list))
+			list_del(&w.list);
+		spin_unlock_irq(&m->lock, irqstate);
 	}
 }
 
 /* mutex_unlock: unlock mutex `m` and wake a waiting thread */
 void mutex_unlock(struct mutex *m)
 {
-	struct task *next;
+	struct wait_entry *w;
 	unsigned long irqstate;
 
 	m->count = 0;
 
 	spin_lock_irq(&m->lock, &irqstate);
 	if (!list_empty(&m->queue)) {
-		next = list_first_entry(&m->queue, struct task, queue);
-		list_del(&next->queue);
-		sched_unblock(next);
+		w = list_first_entry(&m->queue, struct wait_entry, list);
+		list_del(&w->list);
+		sched_unblock(w->task);
 	}
 	spin_unlock_irq(&m->lock, irqstate);
 }
@@ -97,6 +97,9 @@ void percpu_area_setup(void)
 	/* initialize per-CPU variables for the BSP */
 	percpu_init(0);
 
+	/* free page caches can be used now that every CPU has its own */
+	page_cache_enable();
+
 	/*
 	 * TODO: we no longer need the original per-CPU area, so we can add
 	 * it to the page allocator. (Requires adding an additional zone_init
@@ -410,3 +410,69 @@ void rb_replace(struct rb_root *root, struct rb_node *old, struct rb_node *new)
 
 	rb_init(old);
 }
+
+/* rb_first: return the leftmost node in the tree rooted at `root` */
+struct rb_node *rb_first(struct rb_root *root)
+{
+	struct rb_node *node;
+
+	node = root->root_node;
+	if (!node)
+		return NULL;
+
+	while (node->left)
+		node = node->left;
+
+	return node;
+}
+
+/* rb_last: return the rightmost node in the tree rooted at `root` */
+struct rb_node *rb_last(struct rb_root *root)
+{
+	struct rb_node *node;
+
+	node = root->root_node;
+	if (!node)
+		return NULL;
+
+	while (node->right)
+		node = node->right;
+
+	return node;
+}
+
+/* rb_next: return the in-order successor of `node` */
+struct rb_node *rb_next(struct rb_node *node)
+{
+	struct rb_node *pa;
+
+	if (node->right) {
+		node = node->right;
+		while (node->left)
+			node = node->left;
+		return node;
+	}
+
+	while ((pa = rb_parent(node)) && node == pa->right)
+		node = pa;
+
+	return pa;
+}
+
+/* rb_prev: return the in-order predecessor of `node` */
+struct rb_node *rb_prev(struct rb_node *node)
+{
+	struct rb_node *pa;
+
+	if (node->left) {
+		node = node->left;
+		while (node->right)
+			node = node->right;
+		return node;
+	}
+
+	while ((pa = rb_parent(node)) && node == pa->left)
+		node = pa;
+
+	return pa;
+}
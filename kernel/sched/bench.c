@@ -0,0 +1,101 @@
+/*
+ * kernel/sched/bench.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/cpu.h>
+#include <radix/error.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/time.h>
+#include <radix/wait.h>
+
+#include <rlibc/string.h>
+
+#ifdef CONFIG_SCHED_BENCH
+
+#define BENCH_ROUNDS 10000
+
+/*
+ * Two kthreads pinned to the same CPU take turns running, each one
+ * handing over to the other through a wait queue, so that every round
+ * performs exactly one context switch.
+ */
+static struct {
+	struct wait_queue       wq[2];
+	int                     turn;
+	unsigned long long      start_cycles;
+	uint64_t                start_ns;
+} bench = {
+	.wq = { WAIT_QUEUE_INIT(bench.wq[0]), WAIT_QUEUE_INIT(bench.wq[1]) }
+};
+
+static void pingpong_thread(void *arg)
+{
+	unsigned long long cycles;
+	uint64_t ns;
+	int self, i;
+
+	self = (addr_t)arg;
+	if (self == 0) {
+		bench.start_ns = time_ns();
+		bench.start_cycles = cpu_cycles();
+	}
+
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		wait_event(&bench.wq[self], bench.turn == self);
+		bench.turn = !self;
+		wake_up(&bench.wq[!self]);
+	}
+
+	/* thread 1 performs the final handoff */
+	if (self == 1) {
+		cycles = cpu_cycles() - bench.start_cycles;
+		ns = time_ns() - bench.start_ns;
+		klog(KLOG_INFO, "sched: context switch: %llu cycles, %llu ns "
+		     "(%d switches)", cycles / (2 * BENCH_ROUNDS),
+		     ns / (2 * BENCH_ROUNDS), 2 * BENCH_ROUNDS);
+	}
+}
+
+/*
+ * sched_bench:
+ * Measure the average cost of a context switch between two kernel
+ * threads on the current CPU and report it in the kernel log.
+ */
+void sched_bench(void)
+{
+	struct task *t[2];
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		t[i] = kthread_create(pingpong_thread, (void *)i, 0,
+		                      "switch_bench_%d", i);
+		if (IS_ERR(t[i])) {
+			klog(KLOG_ERROR, "sched: could not create benchmark "
+			     "thread: %s", strerror(ERR_VAL(t[i])));
+			return;
+		}
+		t[i]->cpu_restrict = CPUMASK_SELF;
+	}
+
+	for (i = 0; i < 2; ++i)
+		kthread_start(t[i]);
+}
+
+#endif /* CONFIG_SCHED_BENCH */
@@ -0,0 +1,65 @@
+/*
+ * kernel/sched/class.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNEL_SCHED_CLASS_H
+#define KERNEL_SCHED_CLASS_H
+
+#include <radix/task.h>
+#include <radix/types.h>
+
+/* enqueue flags */
+#define ENQUEUE_NEW     (1 << 0)        /* task has never run */
+#define ENQUEUE_WAKEUP  (1 << 1)        /* task was blocked */
+
+/*
+ * A scheduling policy, responsible for ordering the runnable tasks on
+ * each CPU. Run queue operations which take a `cpu` argument are called
+ * with that CPU's run queue lock held.
+ */
+struct sched_class {
+	/* initialize the current CPU's run queue */
+	void (*init)(void);
+	/* set up the scheduling state of a newly created task */
+	void (*task_new)(struct task *t);
+	/* insert runnable task `t` into the run queue of `cpu` */
+	void (*enqueue)(int cpu, struct task *t, int flags);
+	/* remove task `t` from the run queue of `cpu` */
+	void (*dequeue)(int cpu, struct task *t);
+	/* return the task that should run next on `cpu`, or NULL */
+	struct task *(*pick_next)(int cpu, uint64_t now);
+	/* return a task on `cpu` which may migrate to this CPU, or NULL */
+	struct task *(*steal)(int cpu);
+	/* fix up a task dequeued from `cpu` to run on this CPU */
+	void (*migrate)(struct task *t, int cpu);
+	/* charge `elapsed` nanoseconds of runtime to outgoing task `t` */
+	void (*put_prev)(struct task *t, uint64_t elapsed);
+	/* return how long `t` may run on `cpu` before being preempted */
+	uint64_t (*timeslice)(int cpu, struct task *t);
+};
+
+extern const struct sched_class dl_sched_class;
+extern const struct sched_class mlfq_sched_class;
+extern const struct sched_class fair_sched_class;
+
+#ifdef CONFIG_SCHED_FAIR
+#define default_sched_class fair_sched_class
+#else
+#define default_sched_class mlfq_sched_class
+#endif /* CONFIG_SCHED_FAIR */
+
+#endif /* KERNEL_SCHED_CLASS_H */
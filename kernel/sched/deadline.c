@@ -0,0 +1,273 @@
+/*
+ * kernel/sched/deadline.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/error.h>
+#include <radix/event.h>
+#include <radix/kernel.h>
+#include <radix/percpu.h>
+#include <radix/rbtree.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/spinlock.h>
+#include <radix/time.h>
+
+#include "class.h"
+#include "deadline.h"
+
+/*
+ * Earliest deadline first scheduling for tasks with periodic timing
+ * requirements. Each task reserves `runtime` nanoseconds of CPU time
+ * every `period`, to be received within `deadline` of the start of the
+ * period. Deadline tasks always run before tasks of the default class.
+ *
+ * Every deadline task is bound to a single CPU when its parameters are
+ * set, and a CPU only accepts tasks while their total bandwidth stays
+ * under DL_BW_LIMIT, guaranteeing that all of their deadlines can be met.
+ * A task which uses up its runtime is throttled until its next period
+ * so that it cannot starve other tasks.
+ */
+
+#define DL_BW_SHIFT     20
+#define DL_BW_LIMIT     ((95 << DL_BW_SHIFT) / 100)
+#define DL_PERIOD_MAX   NSEC_PER_SEC
+
+static DEFINE_PER_CPU(struct rb_root, dl_tasks) = RB_ROOT;
+
+/* bandwidth reserved by deadline tasks on each CPU */
+static DEFINE_PER_CPU(unsigned long, dl_bw) = 0;
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;
+
+static __always_inline unsigned long __dl_bw(struct task *t)
+{
+	return (t->dl_runtime << DL_BW_SHIFT) / t->dl_period;
+}
+
+/*
+ * sched_set_deadline:
+ * Make `t` a deadline task which runs for `runtime` ns every `period` ns,
+ * finishing within `deadline` ns of the start of each period. This must
+ * be done before the task is started, and binds it to a single CPU.
+ *
+ * Returns EINVAL if the parameters are invalid, or EBUSY if no allowed
+ * CPU has enough spare bandwidth to accept the task.
+ */
+int sched_set_deadline(struct task *t, uint64_t runtime,
+                       uint64_t deadline, uint64_t period)
+{
+	unsigned long bw, best_bw;
+	cpumask_t potential;
+	int cpu, best;
+
+	if (!runtime || runtime > deadline || deadline > period ||
+	    period > DL_PERIOD_MAX || dl_task(t))
+		return EINVAL;
+
+	t->dl_runtime = runtime;
+	t->dl_deadline = deadline;
+	t->dl_period = period;
+	bw = __dl_bw(t);
+
+	potential = cpumask_online() & t->cpu_restrict;
+	best_bw = DL_BW_LIMIT;
+	best = -1;
+
+	spin_lock(&dl_bw_lock);
+	for_each_cpu(cpu, potential) {
+		if (cpu_var(dl_bw, cpu) + bw <= best_bw) {
+			best_bw = cpu_var(dl_bw, cpu) + bw;
+			best = cpu;
+		}
+	}
+	if (best != -1)
+		cpu_var(dl_bw, best) += bw;
+	spin_unlock(&dl_bw_lock);
+
+	if (best == -1) {
+		t->dl_period = 0;
+		return EBUSY;
+	}
+
+	t->cpu_restrict = CPUMASK_CPU(best);
+	t->dl_abs_deadline = 0;
+	t->dl_budget = 0;
+	t->dl_timer = NULL;
+	rb_init(&t->dl_node);
+
+	return 0;
+}
+
+/*
+ * dl_release:
+ * Return the bandwidth reserved by the exiting deadline task `t`.
+ * Called by the task itself, on the CPU to which it is bound.
+ */
+void dl_release(struct task *t)
+{
+	dl_event_del(t);
+
+	spin_lock(&dl_bw_lock);
+	cpu_var(dl_bw, t->cpu) -= __dl_bw(t);
+	spin_unlock(&dl_bw_lock);
+
+	t->dl_period = 0;
+}
+
+/*
+ * dl_throttled:
+ * Check whether the running deadline task `t` has used up its runtime
+ * for the current period. If it has, an event is set to wake it at
+ * the start of its next period and 1 is returned; the caller must take
+ * it off the CPU without requeuing it.
+ */
+int dl_throttled(struct task *t)
+{
+	uint64_t next_period;
+
+	if (t->dl_budget >= (int64_t)MIN_EVENT_DELTA)
+		return 0;
+
+	next_period = t->dl_abs_deadline - t->dl_deadline + t->dl_period;
+
+	/* the task is bound to this CPU, where its old event must live */
+	dl_event_del(t);
+	if (dl_event_add(t, next_period) != 0) {
+		/* let it run again rather than lose the task */
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * __dl_overflow:
+ * Check whether `t` can keep its current deadline and remaining runtime
+ * on becoming runnable at time `now` without exceeding its reserved
+ * bandwidth. If not, it starts a new period.
+ */
+static __always_inline int __dl_overflow(struct task *t, uint64_t now)
+{
+	if (now >= t->dl_abs_deadline)
+		return 1;
+
+	/* throttled tasks wait for their next period instead */
+	if (t->dl_budget < (int64_t)MIN_EVENT_DELTA)
+		return 0;
+
+	return (uint64_t)t->dl_budget * t->dl_period >
+	       (t->dl_abs_deadline - now) * t->dl_runtime;
+}
+
+static void dl_init(void)
+{
+}
+
+static void dl_task_new(struct task *t)
+{
+	(void)t;
+}
+
+static void dl_enqueue(int cpu, struct task *t, int flags)
+{
+	struct rb_node **pos, *parent;
+	struct rb_root *root;
+	struct task *curr;
+	uint64_t now;
+
+	if (flags & (ENQUEUE_NEW | ENQUEUE_WAKEUP)) {
+		/*
+		 * A throttled task may be woken before its next period.
+		 * Deadline tasks are only ever enqueued on their own CPU,
+		 * where the period event was added.
+		 */
+		dl_event_del(t);
+
+		now = time_ns();
+		if (__dl_overflow(t, now)) {
+			t->dl_abs_deadline = now + t->dl_deadline;
+			t->dl_budget = t->dl_runtime;
+		}
+	}
+
+	root = cpu_ptr(&dl_tasks, cpu);
+	pos = &root->root_node;
+	parent = NULL;
+
+	while (*pos) {
+		curr = rb_entry(*pos, struct task, dl_node);
+		parent = *pos;
+
+		if (t->dl_abs_deadline < curr->dl_abs_deadline)
+			pos = &(*pos)->left;
+		else
+			pos = &(*pos)->right;
+	}
+
+	rb_link(&t->dl_node, parent, pos);
+	rb_balance(root, &t->dl_node);
+}
+
+static void dl_dequeue(int cpu, struct task *t)
+{
+	rb_delete(cpu_ptr(&dl_tasks, cpu), &t->dl_node);
+}
+
+static struct task *dl_pick_next(int cpu, uint64_t now)
+{
+	struct rb_node *first;
+
+	first = rb_first(cpu_ptr(&dl_tasks, cpu));
+
+	(void)now;
+	return first ? rb_entry(first, struct task, dl_node) : NULL;
+}
+
+/* deadline tasks are bound to their CPU and never migrate */
+static struct task *dl_steal(int cpu)
+{
+	(void)cpu;
+	return NULL;
+}
+
+static void dl_migrate(struct task *t, int cpu)
+{
+	(void)t;
+	(void)cpu;
+}
+
+static void dl_put_prev(struct task *t, uint64_t elapsed)
+{
+	t->dl_budget -= elapsed;
+}
+
+static uint64_t dl_timeslice(int cpu, struct task *t)
+{
+	(void)cpu;
+	return max(t->dl_budget, (int64_t)MIN_EVENT_DELTA);
+}
+
+const struct sched_class dl_sched_class = {
+	.init           = dl_init,
+	.task_new       = dl_task_new,
+	.enqueue        = dl_enqueue,
+	.dequeue        = dl_dequeue,
+	.pick_next      = dl_pick_next,
+	.steal          = dl_steal,
+	.migrate        = dl_migrate,
+	.put_prev       = dl_put_prev,
+	.timeslice      = dl_timeslice
+};
@@ -0,0 +1,33 @@
+/*
+ * kernel/sched/deadline.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNEL_SCHED_DEADLINE_H
+#define KERNEL_SCHED_DEADLINE_H
+
+#include <radix/task.h>
+
+/* dl_task: check if `t` belongs to the deadline scheduling class */
+static __always_inline int dl_task(struct task *t)
+{
+	return t->dl_period != 0;
+}
+
+int dl_throttled(struct task *t);
+void dl_release(struct task *t);
+
+#endif /* KERNEL_SCHED_DEADLINE_H */
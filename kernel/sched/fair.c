@@ -0,0 +1,249 @@
+/*
+ * kernel/sched/fair.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/kernel.h>
+#include <radix/limits.h>
+#include <radix/percpu.h>
+#include <radix/rbtree.h>
+#include <radix/smp.h>
+#include <radix/time.h>
+
+#include "class.h"
+
+#ifdef CONFIG_SCHED_FAIR
+
+/*
+ * Fair-share scheduling: each task accumulates virtual runtime, its real
+ * runtime scaled inversely by its weight, and the task with the lowest
+ * virtual runtime on a CPU always runs next. Over time, every task
+ * receives a share of the CPU proportional to its weight.
+ */
+
+/* period over which every runnable task should get to run once */
+#define SCHED_LATENCY   (20 * NSEC_PER_MSEC)
+/* shortest timeslice given to a task, regardless of load */
+#define SCHED_MIN_GRAN  (2 * NSEC_PER_MSEC)
+
+#define NICE_MIN        (-20)
+#define NICE_MAX        19
+#define NICE_0_SHIFT    10
+
+/*
+ * 2^32 / weight for each nice value, where a nice 0 task has a weight of
+ * 1024 and each step changes a task's CPU share by about 10%.
+ */
+static const uint32_t nice_to_wmult[NICE_MAX - NICE_MIN + 1] = {
+ /* -20 */      48388,      59856,      76039,      92817,     118348,
+ /* -15 */     147320,     184698,     229616,     287308,     360437,
+ /* -10 */     449829,     563644,     704092,     875808,    1099582,
+ /*  -5 */    1376151,    1717299,    2157191,    2708049,    3363325,
+ /*   0 */    4194304,    5237764,    6557201,    8165337,   10153586,
+ /*   5 */   12820797,   15790320,   19976592,   24970740,   31350126,
+ /*  10 */   39045157,   49367440,   61356675,   76695844,   95443717,
+ /*  15 */  119304647,  148102320,  186737708,  238609294,  286331153
+};
+
+static DEFINE_PER_CPU(struct rb_root, fair_tasks) = RB_ROOT;
+/* monotonic lower bound of the vruntime of all tasks on the CPU */
+static DEFINE_PER_CPU(uint64_t, min_vruntime) = 0;
+static DEFINE_PER_CPU(unsigned int, fair_nr_queued) = 0;
+
+/*
+ * __calc_vdelta:
+ * Scale `delta` nanoseconds of runtime by the weight of task `t`.
+ */
+static __always_inline uint64_t __calc_vdelta(struct task *t, uint64_t delta)
+{
+	int nice;
+
+	nice = clamp(t->priority, NICE_MIN, NICE_MAX);
+
+	/* limit delta to 32 bits so that the product cannot overflow */
+	delta = min(delta, (uint64_t)UINT_MAX);
+	return (delta * nice_to_wmult[nice - NICE_MIN]) >> (32 - NICE_0_SHIFT);
+}
+
+static void fair_init(void)
+{
+}
+
+static void fair_task_new(struct task *t)
+{
+	t->prio_level = 0;
+	t->vruntime = 0;
+	t->vlag = 0;
+	rb_init(&t->fair_node);
+}
+
+/*
+ * fair_enqueue:
+ * Insert task `t` into the vruntime tree of `cpu`. Tasks with equal
+ * vruntimes are ordered by insertion.
+ *
+ * New and woken tasks have their vruntime placed relative to the CPU's
+ * min_vruntime. A woken task may be placed on a different CPU from the one
+ * it slept on, so its vruntime is rebuilt from its lag behind the old CPU's
+ * min_vruntime. It receives at most half a latency period of credit for
+ * its sleep, but keeps any runtime it still owes so that sleeping briefly
+ * cannot be used to reset it.
+ */
+static void fair_enqueue(int cpu, struct task *t, int flags)
+{
+	struct rb_node **pos, *parent;
+	struct rb_root *root;
+	struct task *curr;
+	uint64_t min_vr;
+	int64_t lag;
+
+	min_vr = cpu_var(min_vruntime, cpu);
+	if (flags & ENQUEUE_NEW) {
+		t->vruntime = min_vr;
+	} else if (flags & ENQUEUE_WAKEUP) {
+		lag = -(int64_t)min(min_vr, SCHED_LATENCY / 2);
+		lag = max(t->vlag, lag);
+		t->vruntime = min_vr + lag;
+	}
+
+	root = cpu_ptr(&fair_tasks, cpu);
+	pos = &root->root_node;
+	parent = NULL;
+
+	while (*pos) {
+		curr = rb_entry(*pos, struct task, fair_node);
+		parent = *pos;
+
+		if (t->vruntime < curr->vruntime)
+			pos = &(*pos)->left;
+		else
+			pos = &(*pos)->right;
+	}
+
+	rb_link(&t->fair_node, parent, pos);
+	rb_balance(root, &t->fair_node);
+	++cpu_var(fair_nr_queued, cpu);
+}
+
+static void fair_dequeue(int cpu, struct task *t)
+{
+	rb_delete(cpu_ptr(&fair_tasks, cpu), &t->fair_node);
+	--cpu_var(fair_nr_queued, cpu);
+}
+
+static struct task *fair_pick_next(int cpu, uint64_t now)
+{
+	struct rb_node *first;
+	struct task *t;
+	uint64_t *min_vr;
+
+	first = rb_first(cpu_ptr(&fair_tasks, cpu));
+	if (!first)
+		return NULL;
+
+	/* the outgoing task has been requeued; first is the global minimum */
+	t = rb_entry(first, struct task, fair_node);
+	min_vr = cpu_ptr(&min_vruntime, cpu);
+	*min_vr = max(*min_vr, t->vruntime);
+
+	(void)now;
+	return t;
+}
+
+/*
+ * fair_steal:
+ * Find a task on `cpu` to migrate to this CPU, starting from the one with
+ * the largest vruntime. Only tasks which are allowed to run on this CPU
+ * are considered, and those which are no longer cache hot on `cpu` are
+ * preferred over those which are.
+ */
+static struct task *fair_steal(int cpu)
+{
+	struct rb_node *node;
+	struct task *t, *fallback;
+	cpumask_t self, victim;
+
+	self = CPUMASK_SELF;
+	victim = CPUMASK_CPU(cpu);
+	fallback = NULL;
+
+	for (node = rb_last(cpu_ptr(&fair_tasks, cpu)); node;
+	     node = rb_prev(node)) {
+		t = rb_entry(node, struct task, fair_node);
+		if (!(t->cpu_restrict & self))
+			continue;
+
+		if (!(t->cpu_affinity & victim))
+			return t;
+
+		if (!fallback)
+			fallback = t;
+	}
+
+	return fallback;
+}
+
+/*
+ * fair_migrate:
+ * Move the vruntime of task `t` from the time base of `cpu`
+ * to that of the current CPU.
+ */
+static void fair_migrate(struct task *t, int cpu)
+{
+	t->vruntime -= cpu_var(min_vruntime, cpu);
+	t->vruntime += this_cpu_read(min_vruntime);
+}
+
+/*
+ * fair_put_prev:
+ * Charge the outgoing task `t` for its runtime and record its lag behind
+ * the current CPU's min_vruntime, from which its vruntime is rebuilt if
+ * it goes to sleep and is woken up.
+ */
+static void fair_put_prev(struct task *t, uint64_t elapsed)
+{
+	t->vruntime += __calc_vdelta(t, elapsed);
+	t->vlag = (int64_t)(t->vruntime - this_cpu_read(min_vruntime));
+}
+
+/*
+ * fair_timeslice:
+ * Divide the scheduling latency period evenly between the tasks
+ * on `cpu`, including `t`, which has already been dequeued.
+ */
+static uint64_t fair_timeslice(int cpu, struct task *t)
+{
+	uint64_t slice;
+
+	slice = SCHED_LATENCY / (cpu_var(fair_nr_queued, cpu) + 1);
+
+	(void)t;
+	return max(slice, SCHED_MIN_GRAN);
+}
+
+const struct sched_class fair_sched_class = {
+	.init           = fair_init,
+	.task_new       = fair_task_new,
+	.enqueue        = fair_enqueue,
+	.dequeue        = fair_dequeue,
+	.pick_next      = fair_pick_next,
+	.steal          = fair_steal,
+	.migrate        = fair_migrate,
+	.put_prev       = fair_put_prev,
+	.timeslice      = fair_timeslice
+};
+
+#endif /* CONFIG_SCHED_FAIR */
@@ -16,22 +16,67 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/atomic.h>
+#include <radix/cpu.h>
 #include <radix/error.h>
+#include <radix/ipi.h>
+#include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/kthread.h>
 #include <radix/klog.h>
 #include <radix/percpu.h>
+#include <radix/sched.h>
 #include <radix/smp.h>
 #include <radix/task.h>
 
+#include "idle.h"
+
 DEFINE_PER_CPU(struct task *, idle_task);
 
-static void idle_func(void *p)
+/* set to have the idle task call into the scheduler */
+static DEFINE_PER_CPU(unsigned long, need_resched) = 0;
+/* whether the CPU idles in MWAIT on its need_resched flag */
+static DEFINE_PER_CPU(int, idle_monitor) = 0;
+
+/*
+ * idle_func:
+ * Wait for work with interrupts enabled. Whenever need_resched is set,
+ * by an interrupt on this CPU or by a store from another one, switch
+ * into the scheduler to run whatever was queued.
+ */
+static void idle_func(__unused void *p)
 {
-	while (1)
-		HALT();
+	unsigned long *resched;
+	int monitor;
+
+	resched = this_cpu_ptr(&need_resched);
+	monitor = this_cpu_read(idle_monitor);
+
+	while (1) {
+		irq_disable();
+		if (*resched) {
+			*resched = 0;
+			schedule(1);
+			irq_enable();
+		} else if (monitor) {
+			cpu_idle_monitor(resched);
+		} else {
+			cpu_idle_halt();
+		}
+	}
+}
 
-	(void)p;
+/*
+ * idle_kick:
+ * Get the idle `cpu` to schedule. A CPU idling in MWAIT, or the current
+ * CPU, only needs its need_resched flag set; any other is sent an IPI.
+ */
+void idle_kick(int cpu)
+{
+	if (cpu == processor_id() || cpu_var(idle_monitor, cpu))
+		atomic_write(cpu_ptr(&need_resched, cpu), 1);
+	else
+		send_sched_wake(cpu);
 }
 
 int idle_task_init(void)
@@ -50,6 +95,9 @@ int idle_task_init(void)
 
 	idle->cpu_restrict = CPUMASK_SELF;
 	idle->remaining_time = 0;
+	idle->acct_ts = cpu_cycles();
+
+	this_cpu_write(idle_monitor, !!cpu_idle_has_monitor());
 
 	this_cpu_write(idle_task, idle);
 
@@ -23,5 +23,6 @@ DECLARE_PER_CPU(struct task *, idle_task);
 
 int idle_task_init(void);
 int is_idle(int cpu);
+void idle_kick(int cpu);
 
 #endif /* KERNEL_SCHED_IDLE_H */
@@ -0,0 +1,240 @@
+/*
+ * kernel/sched/mlfq.c
+ * Copyright (C) 2016-2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/bits.h>
+#include <radix/event.h>
+#include <radix/kernel.h>
+#include <radix/list.h>
+#include <radix/percpu.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/time.h>
+
+#include "class.h"
+
+#ifndef CONFIG_SCHED_FAIR
+
+/*
+ * Multi-level feedback queue scheduling: tasks start at the highest
+ * priority level and drop a level each time they use up a timeslice.
+ * Tasks which have waited for PRIO_BOOST_PERIOD are moved back up.
+ */
+
+#define PRIO_BOOST_PERIOD (500 * NSEC_PER_MSEC)
+
+static DEFINE_PER_CPU(struct list, prio_queues[SCHED_PRIO_LEVELS]);
+/* bit i is set if prio_queues[i] is non-empty */
+static DEFINE_PER_CPU(unsigned long, prio_bitmap) = 0;
+/* time of the next MLFQ priority boost check */
+static DEFINE_PER_CPU(uint64_t, next_boost) = 0;
+
+#define PRIO_BIT(prio) (1UL << (prio))
+
+/* XXX: if SCHED_PRIO_LEVELS is changed, this should probably be updated */
+static __always_inline uint64_t __prio_timeslice(int prio)
+{
+	return (5 + (prio / 2)) * NSEC_PER_MSEC;
+}
+
+static void mlfq_init(void)
+{
+	int i;
+
+	for (i = 0; i < SCHED_PRIO_LEVELS; ++i)
+		list_init(raw_cpu_ptr(&prio_queues[i]));
+}
+
+static void mlfq_task_new(struct task *t)
+{
+	t->prio_level = 0;
+	t->remaining_time = __prio_timeslice(t->prio_level);
+}
+
+/*
+ * mlfq_enqueue:
+ * Insert task `t` at the back of the queue for its priority level on `cpu`.
+ */
+static void mlfq_enqueue(int cpu, struct task *t, int flags)
+{
+	list_ins(cpu_ptr(&prio_queues[t->prio_level], cpu), &t->queue);
+	cpu_var(prio_bitmap, cpu) |= PRIO_BIT(t->prio_level);
+
+	(void)flags;
+}
+
+/*
+ * mlfq_dequeue:
+ * Remove task `t` from its priority queue on `cpu`.
+ */
+static void mlfq_dequeue(int cpu, struct task *t)
+{
+	list_del(&t->queue);
+	if (list_empty(cpu_ptr(&prio_queues[t->prio_level], cpu)))
+		cpu_var(prio_bitmap, cpu) &= ~PRIO_BIT(t->prio_level);
+}
+
+/*
+ * __prio_boost_queue:
+ * Iterate over all tasks in the queue for priority level `prio`, boosting
+ * the priority of those which have not been run in a sufficiently long
+ * period.
+ */
+static __always_inline void __prio_boost_queue(int cpu, int prio, uint64_t now)
+{
+	struct list *l, *tmp;
+	struct task *t;
+
+	list_for_each_safe(l, tmp, cpu_ptr(&prio_queues[prio], cpu)) {
+		t = list_entry(l, struct task, queue);
+		if (t->sched_ts == 0 || now - t->sched_ts < PRIO_BOOST_PERIOD)
+			continue;
+
+		mlfq_dequeue(cpu, t);
+		t->prio_level = 0;
+		t->remaining_time = __prio_timeslice(0);
+		mlfq_enqueue(cpu, t, 0);
+	}
+}
+
+/*
+ * __prio_boost:
+ * Move tasks on `cpu` which have been waiting for longer than
+ * PRIO_BOOST_PERIOD back to the highest priority level. The queues are
+ * scanned at most once per period, as part of picking the next task.
+ */
+static void __prio_boost(int cpu, uint64_t now)
+{
+	unsigned long levels;
+	int prio;
+
+	if (now < cpu_var(next_boost, cpu))
+		return;
+
+	cpu_var(next_boost, cpu) = now + PRIO_BOOST_PERIOD;
+
+	/* level 0 tasks are already at the top */
+	levels = cpu_var(prio_bitmap, cpu) & ~PRIO_BIT(0);
+	while (levels) {
+		prio = ffs(levels) - 1;
+		levels &= ~PRIO_BIT(prio);
+		__prio_boost_queue(cpu, prio, now);
+	}
+}
+
+static struct task *mlfq_pick_next(int cpu, uint64_t now)
+{
+	unsigned long levels;
+	int prio;
+
+	__prio_boost(cpu, now);
+
+	levels = cpu_var(prio_bitmap, cpu);
+	if (!levels)
+		return NULL;
+
+	/* lowest set bit is the highest priority non-empty queue */
+	prio = ffs(levels) - 1;
+	return list_first_entry(cpu_ptr(&prio_queues[prio], cpu),
+	                        struct task, queue);
+}
+
+/*
+ * mlfq_steal:
+ * Find a task on `cpu` to migrate to this CPU, starting from the lowest
+ * priority level. Only tasks which are allowed to run on this CPU are
+ * considered, and those which are no longer cache hot on `cpu` are
+ * preferred over those which are.
+ */
+static struct task *mlfq_steal(int cpu)
+{
+	struct task *t, *fallback;
+	cpumask_t self, victim;
+	unsigned long levels;
+	int prio;
+
+	self = CPUMASK_SELF;
+	victim = CPUMASK_CPU(cpu);
+
+	levels = cpu_var(prio_bitmap, cpu);
+	while (levels) {
+		prio = fls(levels) - 1;
+		levels &= ~PRIO_BIT(prio);
+		fallback = NULL;
+
+		list_for_each_entry(t, cpu_ptr(&prio_queues[prio], cpu), queue) {
+			if (!(t->cpu_restrict & self))
+				continue;
+
+			/* evicted from the victim's recent tasks; take it */
+			if (!(t->cpu_affinity & victim))
+				return t;
+
+			if (!fallback)
+				fallback = t;
+		}
+
+		if (fallback)
+			return fallback;
+	}
+
+	return NULL;
+}
+
+static void mlfq_migrate(struct task *t, int cpu)
+{
+	(void)t;
+	(void)cpu;
+}
+
+/*
+ * mlfq_put_prev:
+ * Update the priority level and remaining timeslice of task `t`.
+ */
+static void mlfq_put_prev(struct task *t, uint64_t elapsed)
+{
+	if (elapsed + MIN_EVENT_DELTA >= t->remaining_time) {
+		/*
+		 * The task has used up its alloted time at this
+		 * priority, move it down to the next level.
+		 */
+		t->prio_level = min(t->prio_level + 1, SCHED_PRIO_LEVELS - 1);
+		t->remaining_time = __prio_timeslice(t->prio_level);
+	} else {
+		t->remaining_time -= elapsed;
+	}
+}
+
+static uint64_t mlfq_timeslice(int cpu, struct task *t)
+{
+	(void)cpu;
+	return t->remaining_time;
+}
+
+const struct sched_class mlfq_sched_class = {
+	.init           = mlfq_init,
+	.task_new       = mlfq_task_new,
+	.enqueue        = mlfq_enqueue,
+	.dequeue        = mlfq_dequeue,
+	.pick_next      = mlfq_pick_next,
+	.steal          = mlfq_steal,
+	.migrate        = mlfq_migrate,
+	.put_prev       = mlfq_put_prev,
+	.timeslice      = mlfq_timeslice
+};
+
+#endif /* !CONFIG_SCHED_FAIR */
@@ -17,17 +17,19 @@
  */
 
 #include <radix/assert.h>
+#include <radix/atomic.h>
 #include <radix/compiler.h>
 #include <radix/cpu.h>
 #include <radix/event.h>
+#include <radix/fpu.h>
 #include <radix/ipi.h>
 #include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
-#include <radix/kthread.h>
 #include <radix/limits.h>
 #include <radix/mm.h>
 #include <radix/sched.h>
+#include <radix/preempt.h>
 #include <radix/smp.h>
 #include <radix/spinlock.h>
 #include <radix/tasking.h>
@@ -35,73 +37,266 @@
 
 #include <rlibc/string.h>
 
+#include "class.h"
+#include "deadline.h"
 #include "idle.h"
+#include "stats.h"
 
-#define SCHED_PRIO_LEVELS 20
 #define SCHED_NUM_RECENT  8
-#define PRIO_BOOST_PERIOD (500 * NSEC_PER_MSEC)
 
 #define SCHED "sched: "
 
 DEFINE_PER_CPU(struct task *, current_task) = NULL;
 
-static DEFINE_PER_CPU(struct list, prio_queues[SCHED_PRIO_LEVELS]);
-static DEFINE_PER_CPU(spinlock_t, queue_locks[SCHED_PRIO_LEVELS]) =
-	{ SPINLOCK_INIT };
+DEFINE_PER_CPU(int, preempt_count) = 0;
+DEFINE_PER_CPU(int, preempt_pending) = 0;
+
+static const struct sched_class *const sched_class = &default_sched_class;
+
+/*
+ * A CPU's run queue. The runnable tasks themselves are ordered by the
+ * scheduling classes; this holds the state common to all of them.
+ *
+ * Other CPUs never queue tasks here directly. Tasks woken remotely are
+ * pushed onto the lock-free wake list instead, which the owning CPU moves
+ * into its queues the next time it schedules.
+ */
+struct runqueue {
+	/* protects everything below except the wake list */
+	spinlock_t      lock;
+	/* number of tasks in the scheduling classes' queues */
+	int             nr_queued;
+	/* number of runnable tasks on the CPU, including the running one */
+	int             nr_active;
+	/*
+	 * Set when the running task was scheduled with nothing else queued
+	 * on the CPU, in which case no scheduler event is armed to preempt it.
+	 */
+	unsigned long   tick_stopped;
+	/* tasks woken by other CPUs, most recently woken first */
+	struct task     *wake_list;
+	/* number of tasks on the wake list, updated atomically */
+	unsigned long   nr_waking;
+};
+
+static DEFINE_PER_CPU(struct runqueue, runqueue) = {
+	.lock = SPINLOCK_INIT
+};
+/* tasks which last ran on each CPU, protected by its run queue lock */
 static DEFINE_PER_CPU(struct task *, recent_tasks[SCHED_NUM_RECENT]) = { NULL };
-static DEFINE_PER_CPU(struct task *, prio_boost_task) = NULL;
 
-static DEFINE_PER_CPU(int, active_tasks) = 0;
+#define cpu_rq(cpu) cpu_ptr(&runqueue, cpu)
+#define this_rq()   this_cpu_ptr(&runqueue)
+
+/*
+ * __rq_load:
+ * Return the number of runnable tasks on `cpu`, including those which
+ * have been pushed onto its wake list but not yet moved into its queues.
+ */
+static __always_inline int __rq_load(int cpu)
+{
+	struct runqueue *rq = cpu_rq(cpu);
+
+	return rq->nr_active + (int)rq->nr_waking;
+}
+
+/* __rq_add_waking: adjust the wake list count of `rq`, from any CPU */
+static __always_inline void __rq_add_waking(struct runqueue *rq, long n)
+{
+	unsigned long old;
+
+	do {
+		old = rq->nr_waking;
+	} while (atomic_cmpxchg(&rq->nr_waking, old, old + n) != old);
+}
 
-static void __prio_boost(void *p);
+int sched_init(void)
+{
+	sched_class->init();
+
+	if (idle_task_init() != 0)
+		return 1;
+
+	return 0;
+}
+
+/* __task_class: return the scheduling class to which task `t` belongs */
+static __always_inline const struct sched_class *__task_class(struct task *t)
+{
+	return dl_task(t) ? &dl_sched_class : sched_class;
+}
 
 /*
- * __pb_task_init:
- * Initialize this processor's MLFQ priority boosting task.
+ * __rq_enqueue:
+ * Insert task `t` into the run queue of `cpu`.
+ * The run queue's lock must be held.
  */
-static int __pb_task_init(void)
+static __always_inline void __rq_enqueue(int cpu, struct task *t, int flags)
 {
-	struct task *pb;
-	int cpu;
+	__task_class(t)->enqueue(cpu, t, flags);
+	++cpu_rq(cpu)->nr_queued;
+}
+
+/*
+ * __rq_dequeue:
+ * Remove task `t` from the run queue of `cpu`.
+ * The run queue's lock must be held.
+ */
+static __always_inline void __rq_dequeue(int cpu, struct task *t)
+{
+	__task_class(t)->dequeue(cpu, t);
+	--cpu_rq(cpu)->nr_queued;
+}
+
+/*
+ * __dl_preempts:
+ * Check whether task `t` should immediately preempt the task running
+ * on `cpu`, which is the case for a deadline task with an earlier
+ * deadline than the current task's.
+ */
+static __always_inline int __dl_preempts(int cpu, struct task *t)
+{
+	struct task *curr;
+
+	if (!dl_task(t))
+		return 0;
+
+	curr = cpu_var(current_task, cpu);
+	if (!curr)
+		return 0;
+
+	return !dl_task(curr) || t->dl_abs_deadline < curr->dl_abs_deadline;
+}
+
+/*
+ * __kick_local:
+ * Make sure that this CPU notices task `t`, which has just been queued on
+ * it. If the CPU is idle or `t` should preempt the running task, it is
+ * rescheduled immediately. If the scheduler tick is stopped, it is
+ * restarted so that the running task is preempted at the end of its
+ * timeslice. The run queue's lock must be held with interrupts disabled.
+ */
+static void __kick_local(struct task *t)
+{
+	struct runqueue *rq;
+	struct task *curr;
+	int cpu, err;
 
 	cpu = processor_id();
-	pb = kthread_create(__prio_boost, NULL, 0,
-	                    "prio_boost_%u", cpu);
-	if (IS_ERR(pb)) {
-		klog(KLOG_ERROR, SCHED
-		     "failed to initialize priority boost task for cpu %u",
-		     cpu);
-		return 1;
+	rq = this_rq();
+
+	/* the idle loop schedules as soon as the interrupt returns */
+	if (is_idle(cpu)) {
+		idle_kick(cpu);
+		return;
 	}
 
-	pb->cpu_restrict = CPUMASK_SELF;
+	if (__dl_preempts(cpu, t)) {
+		rq->tick_stopped = 0;
+		send_sched_wake(cpu);
+		return;
+	}
 
-	this_cpu_write(prio_boost_task, pb);
-	kthread_start(pb);
+	if (!rq->tick_stopped)
+		return;
 
-	return 0;
+	rq->tick_stopped = 0;
+
+	curr = current_task();
+	if ((err = sched_event_add(curr->sched_ts + curr->remaining_time)))
+		panic("could not create scheduler event for cpu %u: %s\n",
+		      cpu, strerror(err));
 }
 
-int sched_init(void)
+/*
+ * __wake_list_push:
+ * Queue task `t` on another CPU by pushing it onto the CPU's wake list.
+ * An idle CPU is kicked out of its idle loop to pick it up. Busy CPUs are
+ * interrupted if their scheduler tick is stopped or if `t` is a deadline
+ * task which may preempt the running task. Otherwise, the task is queued
+ * at the CPU's next tick.
+ */
+static void __wake_list_push(int cpu, struct task *t, int flags)
 {
-	int i;
+	struct runqueue *rq;
+	struct task *head;
+
+	rq = cpu_rq(cpu);
+	t->wake_flags = flags;
+
+	/* count the task before it can be drained, so the CPU looks busy */
+	__rq_add_waking(rq, 1);
+
+	do {
+		head = rq->wake_list;
+		t->wake_next = head;
+	} while (atomic_cmpxchg((unsigned long *)&rq->wake_list,
+	                        (unsigned long)head, (unsigned long)t)
+	         != (unsigned long)head);
+
+	/*
+	 * The locked cmpxchg orders the push before the read of tick_stopped.
+	 * This pairs with __select_next_task(), which sets tick_stopped before
+	 * checking the wake list, so at least one side sees the other.
+	 */
+	if (is_idle(cpu))
+		idle_kick(cpu);
+	else if (dl_task(t) || rq->tick_stopped)
+		send_sched_wake(cpu);
+}
 
-	for (i = 0; i < SCHED_PRIO_LEVELS; ++i)
-		list_init(raw_cpu_ptr(&prio_queues[i]));
+/*
+ * __wake_list_drain:
+ * Move all tasks pushed onto this CPU's wake list into its run queue,
+ * in the order in which they were woken up.
+ * The run queue's lock must be held.
+ */
+static void __wake_list_drain(struct runqueue *rq, int cpu)
+{
+	struct task *list, *next, *prev;
+	long n;
 
-	if (idle_task_init() != 0)
-		return 1;
+	if (!rq->wake_list)
+		return;
 
-	if (__pb_task_init() != 0)
-		return 1;
+	list = (struct task *)atomic_swap((unsigned long *)&rq->wake_list, 0);
 
-	return 0;
+	for (prev = NULL; list; list = next) {
+		next = list->wake_next;
+		list->wake_next = prev;
+		prev = list;
+	}
+
+	for (n = 0, list = prev; list; list = next, ++n) {
+		next = list->wake_next;
+		list->wake_next = NULL;
+		__rq_enqueue(cpu, list, list->wake_flags);
+		++rq->nr_active;
+	}
+	__rq_add_waking(rq, -n);
 }
 
-/* XXX: if SCHED_PRIO_LEVELS is changed, this should probably be updated */
-static __always_inline uint64_t __prio_timeslice(int prio)
+/*
+ * __queue_task:
+ * Queue runnable task `t` on `cpu`. Tasks for the current CPU go straight
+ * into its run queue; any other CPU receives them through its wake list.
+ * Interrupts must be disabled.
+ */
+static void __queue_task(int cpu, struct task *t, int flags)
 {
-	return (5 + (prio / 2)) * NSEC_PER_MSEC;
+	struct runqueue *rq;
+
+	if (cpu != processor_id()) {
+		__wake_list_push(cpu, t, flags);
+		return;
+	}
+
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	__rq_enqueue(cpu, t, flags);
+	++rq->nr_active;
+	__kick_local(t);
+	spin_unlock(&rq->lock);
 }
 
 /*
@@ -118,7 +313,7 @@ static int __find_best_cpu(struct task *t)
 	best = -1;
 
 	for_each_cpu(cpu, potential) {
-		curr_tasks = cpu_var(active_tasks, cpu);
+		curr_tasks = __rq_load(cpu);
 		/* If the CPU is idle, choose it. */
 		if (!curr_tasks)
 			return cpu;
@@ -134,47 +329,136 @@ static int __find_best_cpu(struct task *t)
 
 int sched_add(struct task *t)
 {
-	int cpu, *active;
+	unsigned long irqstate;
+	int cpu;
+
+	irq_save(irqstate);
 
 	cpu = __find_best_cpu(t);
-	if (cpu == -1)
+	if (cpu == -1) {
+		irq_restore(irqstate);
 		return 1;
+	}
 
-	t->prio_level = 0;
 	t->sched_ts = 0;
-	t->remaining_time = __prio_timeslice(t->prio_level);
-	list_ins(cpu_ptr(&prio_queues[t->prio_level], cpu), &t->queue);
+	t->acct_ts = cpu_cycles();
+	t->cpu = cpu;
+	sched_class->task_new(t);
+	sched_stats_enqueue(t, time_ns());
+	__queue_task(cpu, t, ENQUEUE_NEW);
 
-	active = cpu_ptr(&active_tasks, cpu);
-	++*active;
+	irq_restore(irqstate);
+	return 0;
+}
 
-	if (is_idle(cpu))
-		send_sched_wake(cpu);
+/*
+ * __find_busiest_cpu:
+ * Find the online CPU, other than the current one, with the most active
+ * tasks. Only CPUs which have at least one task waiting in their queues
+ * are considered. Returns -1 if there are none.
+ */
+static int __find_busiest_cpu(void)
+{
+	int cpu, busiest, max_tasks, curr_tasks;
+	cpumask_t potential;
 
-	return 0;
+	potential = cpumask_online() & CPUMASK_ALL_OTHER;
+	max_tasks = 1;
+	busiest = -1;
+
+	for_each_cpu(cpu, potential) {
+		curr_tasks = cpu_rq(cpu)->nr_active;
+		if (curr_tasks > max_tasks) {
+			max_tasks = curr_tasks;
+			busiest = cpu;
+		}
+	}
+
+	return busiest;
 }
 
-static struct task *__select_next_task(void)
+/*
+ * __steal_task:
+ * Pull a runnable task chosen by the scheduling class off the busiest
+ * CPU's run queue onto this one.
+ * Returns the stolen task, or NULL if no task could be migrated.
+ */
+static struct task *__steal_task(void)
 {
+	struct runqueue *rq;
 	struct task *t;
-	struct list *queue;
-	spinlock_t *lock;
-	int prio;
-
-	t = NULL;
-	for (prio = 0; prio < SCHED_PRIO_LEVELS; ++prio) {
-		queue = this_cpu_ptr(&prio_queues[prio]);
-		lock = this_cpu_ptr(&queue_locks[prio]);
-
-		spin_lock(lock);
-		if (!list_empty(queue)) {
-			t = list_first_entry(queue, struct task, queue);
-			list_del(&t->queue);
-			spin_unlock(lock);
-			break;
-		}
-		spin_unlock(lock);
+	int cpu;
+
+	cpu = __find_busiest_cpu();
+	if (cpu == -1)
+		return NULL;
+
+	rq = cpu_rq(cpu);
+
+	spin_lock(&rq->lock);
+	t = sched_class->steal(cpu);
+	if (t) {
+		__rq_dequeue(cpu, t);
+		sched_class->migrate(t, cpu);
+		--rq->nr_active;
 	}
+	spin_unlock(&rq->lock);
+
+	if (!t)
+		return NULL;
+
+	t->cpu = processor_id();
+
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	++rq->nr_active;
+	spin_unlock(&rq->lock);
+
+	return t;
+}
+
+static struct task *__select_next_task(uint64_t now)
+{
+	struct runqueue *rq;
+	struct task *t;
+	int cpu;
+
+	cpu = processor_id();
+	rq = this_rq();
+
+	spin_lock(&rq->lock);
+	__wake_list_drain(rq, cpu);
+
+	t = dl_sched_class.pick_next(cpu, now);
+	if (!t)
+		t = sched_class->pick_next(cpu, now);
+	if (t)
+		__rq_dequeue(cpu, t);
+#ifdef CONFIG_SCHED_TICKLESS
+	/*
+	 * If nothing else is waiting to run, there is no timeslice to
+	 * enforce, except for the runtime of a deadline task. Deciding this
+	 * under the run queue lock guarantees that any task queued locally
+	 * afterwards sees the stopped tick and restarts it.
+	 *
+	 * Remote wakeups don't take the lock. The swap is a full barrier, so
+	 * either a task pushed onto the wake list concurrently is seen here
+	 * and the tick is kept, or its waker sees the stopped tick and
+	 * interrupts this CPU.
+	 */
+	if (!rq->nr_queued && !(t && dl_task(t))) {
+		atomic_swap(&rq->tick_stopped, 1);
+		if (rq->wake_list)
+			rq->tick_stopped = 0;
+	} else {
+		rq->tick_stopped = 0;
+	}
+#endif
+	spin_unlock(&rq->lock);
+
+	/* nothing to run locally; try to take some work from another CPU */
+	if (!t)
+		t = __steal_task();
 
 	return t ? t : this_cpu_read(idle_task);
 }
@@ -182,6 +466,8 @@ static struct task *__select_next_task(void)
 /*
  * __update_recent_tasks:
  * Add the specified task to this CPU's list of recently run tasks.
+ * The run queue's lock must be held, as exiting tasks are removed from
+ * the list by other CPUs.
  */
 static void __update_recent_tasks(struct task *new)
 {
@@ -197,40 +483,82 @@ static void __update_recent_tasks(struct task *new)
 	recent[0] = new;
 }
 
+/*
+ * __account_out:
+ * Charge task `t` for the cycles it has run since it was switched in.
+ * Called before the task can be requeued or woken elsewhere.
+ */
+static __always_inline void __account_out(struct task *t, uint64_t cycles)
+{
+	if (cycles > t->acct_ts)
+		t->run_cycles += cycles - t->acct_ts;
+	t->acct_ts = cycles;
+}
+
+/*
+ * __account_in:
+ * Charge task `next` for the cycles it spent waiting in a run queue
+ * and count the switch away from `prev`.
+ */
+static __always_inline void __account_in(struct task *prev, struct task *next,
+                                         int voluntary, uint64_t cycles)
+{
+	if (prev == next)
+		return;
+
+	if (prev) {
+		if (voluntary)
+			++prev->nr_voluntary;
+		else
+			++prev->nr_involuntary;
+	}
+
+	if (cycles > next->acct_ts)
+		next->wait_cycles += cycles - next->acct_ts;
+	next->acct_ts = cycles;
+}
+
 /*
  * __handle_outgoing_task:
- * Update the priority queue and remaining timeslice of the specified task.
+ * Charge the specified task for its runtime and requeue it if it is
+ * still runnable. A task which is preempted stays runnable even if it
+ * has marked itself as blocked, as it may not have checked its wait
+ * condition yet.
  */
-static void __handle_outgoing_task(struct task *outgoing, uint64_t now)
+static void __handle_outgoing_task(struct task *outgoing, uint64_t now,
+                                   int preempted)
 {
+	struct runqueue *rq;
 	uint64_t elapsed;
-	spinlock_t *lock;
 
 	elapsed = now - outgoing->sched_ts;
-	if (elapsed + MIN_EVENT_DELTA >= outgoing->remaining_time) {
-		/*
-		 * The task has used up its alloted time at this
-		 * priority, move it down to the next level.
-		 */
-		outgoing->prio_level = min(outgoing->prio_level + 1,
-		                           SCHED_PRIO_LEVELS - 1);
-		outgoing->remaining_time =
-		        __prio_timeslice(outgoing->prio_level);
-	} else {
-		outgoing->remaining_time -= elapsed;
-	}
+	sched_stats_run(outgoing, elapsed);
+	__task_class(outgoing)->put_prev(outgoing, elapsed);
+
+	rq = this_rq();
+	spin_lock(&rq->lock);
 
 	__update_recent_tasks(outgoing);
 
-	if (outgoing->state != TASK_BLOCKED) {
+	/*
+	 * A blocked task is marked as asleep once it is off the queues.
+	 * From then on, sched_unblock() is responsible for requeuing it.
+	 */
+	if (!preempted && atomic_cmpxchg(&outgoing->state, TASK_BLOCKED,
+	                                 TASK_ASLEEP) == TASK_BLOCKED) {
+		/* blocked tasks are re-counted wherever they are woken up */
+		--rq->nr_active;
+	} else if (dl_task(outgoing) && dl_throttled(outgoing)) {
+		/* woken by its sleep event at the start of its next period */
+		outgoing->state = TASK_ASLEEP;
+		--rq->nr_active;
+	} else {
 		outgoing->state = TASK_READY;
-
-		lock = this_cpu_ptr(&queue_locks[outgoing->prio_level]);
-		spin_lock(lock);
-		list_ins(this_cpu_ptr(&prio_queues[outgoing->prio_level]),
-		         &outgoing->queue);
-		spin_unlock(lock);
+		sched_stats_enqueue(outgoing, now);
+		__rq_enqueue(processor_id(), outgoing, 0);
 	}
+
+	spin_unlock(&rq->lock);
 }
 
 static void __prepare_next_task(struct task *next, uint64_t now)
@@ -246,102 +574,235 @@ static void __prepare_next_task(struct task *next, uint64_t now)
 
 	switch_address_space(next->vmm);
 
+	if (next != this_cpu_read(idle_task))
+		next->remaining_time =
+		        __task_class(next)->timeslice(processor_id(), next);
+
+	if (this_rq()->tick_stopped)
+		return;
+
 	/* TODO: figure out how to handle failed sched event insertions */
 	if ((err = sched_event_add(now + next->remaining_time)))
 		panic("could not create scheduler event for cpu %u: %s\n",
 		      processor_id(), strerror(err));
 }
 
-void schedule(int preempt)
+/*
+ * __schedule:
+ * Pick the next task to run on the current CPU. If `switch_now` is set,
+ * switch to it immediately; otherwise the caller is an interrupt handler
+ * which returns into it. `preempted` is set if the current task did not
+ * give up the CPU itself.
+ *
+ * Interrupts and preemption are disabled throughout, so that a tick cannot
+ * reenter the scheduler on a task which is halfway through being switched
+ * out. Every task reaches switch_task() with the same preempt_count, and
+ * tasks which switch_task() resumes restore their own interrupt state.
+ */
+static void __schedule(int switch_now, int preempted)
 {
 	struct task *curr, *next;
-	uint64_t now;
+	uint64_t now, cycles;
+	unsigned long irqstate;
+
+	irq_save(irqstate);
+	preempt_disable();
+	this_cpu_write(preempt_pending, 0);
 
 	now = time_ns();
+	cycles = cpu_cycles();
 	curr = current_task();
 
+	if (curr)
+		__account_out(curr, cycles);
 	if (curr && curr != this_cpu_read(idle_task))
-		__handle_outgoing_task(curr, now);
+		__handle_outgoing_task(curr, now, preempted);
 
-	if (preempt)
-		sched_event_del();
+	/* any pending tick is replaced by one for the next task */
+	sched_event_del();
 
-	next = __select_next_task();
+	next = __select_next_task(now);
 	assert(next);
+	sched_stats_switch(curr, next, !preempted, now);
+	__account_in(curr, next, !preempted, cycles);
 	__prepare_next_task(next, now);
 
-	if (preempt && curr != next)
+	if (curr != next)
+		fpu_switch(curr, next);
+
+	preempt_enable_no_resched();
+	if (switch_now && curr != next)
 		switch_task(curr, next);
+
+	irq_restore(irqstate);
+
+	/* carry out any preemption which was requested during the switch */
+	if (switch_now && unlikely(this_cpu_read(preempt_pending)))
+		preempt_schedule();
+}
+
+void schedule(int preempt)
+{
+	/*
+	 * The interrupted task cannot be preempted right now. Scheduling is
+	 * retried once it re-enables preemption.
+	 */
+	if (!preempt && preempt_count()) {
+		this_cpu_write(preempt_pending, 1);
+		return;
+	}
+
+	__schedule(preempt, !preempt);
 }
 
 /*
- * __prio_boost_queue:
- * Iterate over all tasks in the specified queue, boosting the priority
- * of those which have not been run in a sufficiently long period.
+ * preempt_schedule:
+ * Carry out a preemption which was deferred while preemption was disabled.
+ * A task with interrupts enabled switches out immediately. In interrupt
+ * context, or with interrupts disabled, a scheduler IPI is sent to the
+ * current CPU instead, to be taken as soon as interrupts are enabled.
  */
-static __always_inline void __prio_boost_queue(struct list *queue,
-                                               spinlock_t *lock,
-                                               uint64_t now)
+void preempt_schedule(void)
 {
-	struct list *l, *tmp, *top;
-	struct task *t;
-	spinlock_t *sl;
 	unsigned long irqstate;
 
-	if (list_empty(queue))
-		return;
+	irq_save(irqstate);
+	if (preempt_count() || !this_cpu_read(preempt_pending))
+		goto out_restore;
 
-	top = raw_cpu_ptr(&prio_queues[0]);
-	sl = raw_cpu_ptr(&queue_locks[0]);
+	if (!irqstate || in_irq()) {
+		this_cpu_write(preempt_pending, 0);
+		send_sched_wake(processor_id());
+	} else {
+		__schedule(1, 1);
+	}
+
+out_restore:
+	irq_restore(irqstate);
+}
+
+/*
+ * sched_del:
+ * Remove the exiting task `t` from the scheduler. Must be called by the
+ * task itself with interrupts disabled, before it is freed.
+ */
+void sched_del(struct task *t)
+{
+	struct runqueue *rq;
+	struct task **recent;
+	int cpu, i;
+
+	if (dl_task(t))
+		dl_release(t);
+
+	/* don't leave a dangling pointer to be evicted later */
+	for_each_cpu(cpu, cpumask_online()) {
+		rq = cpu_rq(cpu);
+		spin_lock(&rq->lock);
+		recent = cpu_ptr(&recent_tasks[0], cpu);
+		for (i = 0; i < SCHED_NUM_RECENT; ++i) {
+			if (recent[i] == t)
+				recent[i] = NULL;
+		}
+		spin_unlock(&rq->lock);
+	}
 
-	spin_lock_irq(lock, &irqstate);
-	list_for_each_safe(l, tmp, queue) {
-		t = list_entry(l, struct task, queue);
-		if (t->sched_ts == 0 || now - t->sched_ts < PRIO_BOOST_PERIOD)
-			continue;
+	rq = this_rq();
+	spin_lock(&rq->lock);
+	--rq->nr_active;
+	spin_unlock(&rq->lock);
+}
 
-		list_del(&t->queue);
-		t->prio_level = 0;
-		t->remaining_time = __prio_timeslice(0);
+/*
+ * __recent_position:
+ * Return the position of task `t` in the recently run list of `cpu`,
+ * or SCHED_NUM_RECENT if it is not in the list. Lower is warmer.
+ */
+static int __recent_position(struct task *t, int cpu)
+{
+	struct task **recent;
+	int i;
 
-		spin_lock(sl);
-		list_ins(top, &t->queue);
-		spin_unlock(sl);
+	recent = cpu_ptr(&recent_tasks[0], cpu);
+	for (i = 0; i < SCHED_NUM_RECENT; ++i) {
+		if (recent[i] == t)
+			break;
 	}
-	spin_unlock_irq(lock, irqstate);
+
+	return i;
 }
 
-static __noreturn void __prio_boost(void *p)
+/*
+ * __find_wake_cpu:
+ * Find the most suitable CPU on which to run the woken task `t`.
+ * An idle CPU on which the task is still cache hot is chosen first,
+ * followed by any idle CPU. If every allowed CPU is busy, the CPU which
+ * ran the task most recently wins, with ties going to the least loaded.
+ */
+static int __find_wake_cpu(struct task *t)
 {
-	struct task *this;
-	uint64_t now;
-	int prio;
-
-	while (1) {
-		this = current_task();
-		assert(this);
-		now = time_ns();
-
-		for (prio = 1; prio < SCHED_PRIO_LEVELS; ++prio)
-			__prio_boost_queue(raw_cpu_ptr(&prio_queues[prio]),
-					   raw_cpu_ptr(&queue_locks[prio]),
-					   now);
-
-		/* reset timeslice so that task's prio_level is never dropped */
-		this->prio_level = 0;
-		this->remaining_time = __prio_timeslice(0);
-
-		/* TODO: replace this with a sleep until the next boost check */
-		schedule(1);
+	int cpu, best, best_pos, pos;
+	cpumask_t warm;
+
+	warm = t->cpu_affinity & t->cpu_restrict & cpumask_online();
+	for_each_cpu(cpu, warm) {
+		if (is_idle(cpu))
+			return cpu;
+	}
+
+	best = __find_best_cpu(t);
+	if (best == -1 || !__rq_load(best))
+		return best;
+
+	best_pos = SCHED_NUM_RECENT + 1;
+	for_each_cpu(cpu, warm) {
+		pos = __recent_position(t, cpu);
+		if (pos < best_pos || (pos == best_pos &&
+		    __rq_load(cpu) < __rq_load(best))) {
+			best_pos = pos;
+			best = cpu;
+		}
 	}
 
-	(void)p;
+	return best;
 }
 
-/* TODO: implement */
+/*
+ * sched_unblock:
+ * Wake up the blocked task `t` and queue it to run on a suitable CPU.
+ * Tasks which are still on their CPU have their block cancelled instead.
+ * Tasks which are not blocked are left alone, so racing wakeups of the
+ * same task are harmless.
+ */
 void sched_unblock(struct task *t)
 {
+	unsigned long irqstate;
+	int cpu;
+
 	assert(t);
-	/* temporary code so that mutexes work */
-	list_ins(cpu_ptr(&prio_queues[t->prio_level], 0), &t->queue);
+
+	irq_save(irqstate);
+
+	/*
+	 * The task has marked itself as blocked but has not yet been
+	 * switched out. Cancel the block; it will be requeued normally.
+	 */
+	if (atomic_cmpxchg(&t->state, TASK_BLOCKED, TASK_RUNNING) == TASK_BLOCKED)
+		goto out_restore;
+
+	if (atomic_cmpxchg(&t->state, TASK_ASLEEP, TASK_READY) != TASK_ASLEEP)
+		goto out_restore;
+
+	cpu = __find_wake_cpu(t);
+	if (cpu == -1) {
+		/* the task's cpu_restrict contains no online CPUs */
+		cpu = t->cpu;
+	}
+	t->cpu = cpu;
+	t->acct_ts = cpu_cycles();
+	sched_stats_enqueue(t, time_ns());
+	__queue_task(cpu, t, ENQUEUE_WAKEUP);
+
+out_restore:
+	irq_restore(irqstate);
 }
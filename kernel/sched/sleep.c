@@ -0,0 +1,108 @@
+/*
+ * kernel/sched/sleep.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/assert.h>
+#include <radix/error.h>
+#include <radix/event.h>
+#include <radix/irq.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/task.h>
+#include <radix/time.h>
+
+/*
+ * schedule_timeout:
+ * Switch out the current task, which must already have marked itself as
+ * TASK_BLOCKED, until it is woken up or the time `deadline` is reached.
+ * A deadline of 0 waits without a timeout.
+ *
+ * Sleep events live in a single CPU's event queue, so the task is
+ * restricted to the current CPU for the duration of the wait. This
+ * guarantees that it resumes where its event can be cancelled.
+ *
+ * Returns 0 if the task was woken up, ETIMEDOUT if the deadline passed
+ * or an error code if the sleep event could not be created.
+ */
+int schedule_timeout(uint64_t deadline)
+{
+	struct task *curr;
+	cpumask_t saved_restrict;
+	unsigned long irqstate;
+	int err;
+
+	curr = current_task();
+	assert(curr);
+
+	if (!deadline) {
+		schedule(1);
+		return 0;
+	}
+
+	if (deadline <= time_ns()) {
+		curr->state = TASK_RUNNING;
+		return ETIMEDOUT;
+	}
+
+	irq_save(irqstate);
+	saved_restrict = curr->cpu_restrict;
+	curr->cpu_restrict = CPUMASK_SELF;
+	if ((err = sleep_event_add(curr, deadline))) {
+		curr->cpu_restrict = saved_restrict;
+		curr->state = TASK_RUNNING;
+		irq_restore(irqstate);
+		return err;
+	}
+	irq_restore(irqstate);
+
+	schedule(1);
+
+	irq_save(irqstate);
+	/* the event clears the task's pointer to it once it has fired */
+	err = curr->sleep_event ? 0 : ETIMEDOUT;
+	sleep_event_del(curr);
+	curr->cpu_restrict = saved_restrict;
+	irq_restore(irqstate);
+
+	return err;
+}
+
+/*
+ * sleep_until:
+ * Block the current task until the time `timestamp` is reached.
+ */
+int sleep_until(uint64_t timestamp)
+{
+	int err;
+
+	/* keep sleeping through any spurious wakeups */
+	do {
+		current_task()->state = TASK_BLOCKED;
+		err = schedule_timeout(timestamp);
+	} while (!err);
+
+	return err == ETIMEDOUT ? 0 : err;
+}
+
+/*
+ * sleep_ns:
+ * Block the current task for at least `ns` nanoseconds.
+ */
+int sleep_ns(uint64_t ns)
+{
+	return sleep_until(time_ns() + ns);
+}
@@ -0,0 +1,143 @@
+/*
+ * kernel/sched/stats.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/bits.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/percpu.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+
+#include "idle.h"
+#include "stats.h"
+
+#ifdef CONFIG_SCHED_STATS
+
+/*
+ * Histogram bucket i counts values in the range [2^(i-1), 2^i) ns.
+ * The last bucket also holds everything above it (~1s).
+ */
+#define SCHED_HIST_BUCKETS 32
+
+struct sched_stats {
+	uint64_t        switches;
+	uint64_t        voluntary;
+	uint64_t        preempted;
+	uint64_t        level_time[SCHED_PRIO_LEVELS];
+	uint32_t        wait_hist[SCHED_HIST_BUCKETS];
+	uint32_t        run_hist[SCHED_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct sched_stats, sched_stats);
+
+static __always_inline void __hist_add(uint32_t *hist, uint64_t ns)
+{
+	++hist[min(fls(ns), SCHED_HIST_BUCKETS - 1U)];
+}
+
+/*
+ * sched_stats_enqueue:
+ * Record the time at which task `t` was placed into a run queue.
+ */
+void sched_stats_enqueue(struct task *t, uint64_t now)
+{
+	t->queue_ts = now;
+}
+
+/*
+ * sched_stats_run:
+ * Account `elapsed` nanoseconds of runtime for the outgoing task `t`
+ * at its current priority level.
+ */
+void sched_stats_run(struct task *t, uint64_t elapsed)
+{
+	struct sched_stats *s;
+
+	s = raw_cpu_ptr(&sched_stats);
+	s->level_time[t->prio_level] += elapsed;
+	__hist_add(s->run_hist, elapsed);
+}
+
+/*
+ * sched_stats_switch:
+ * Record a context switch from `prev` to `next` on this CPU.
+ * The time `next` spent waiting in its run queue is added to the
+ * wakeup latency histogram.
+ */
+void sched_stats_switch(struct task *prev, struct task *next,
+                        int voluntary, uint64_t now)
+{
+	struct sched_stats *s;
+
+	if (prev == next)
+		return;
+
+	s = raw_cpu_ptr(&sched_stats);
+	++s->switches;
+	if (voluntary)
+		++s->voluntary;
+	else
+		++s->preempted;
+
+	if (next != raw_cpu_read(idle_task) && next->queue_ts)
+		__hist_add(s->wait_hist, now - next->queue_ts);
+}
+
+static void __hist_dump(const char *name, uint32_t *hist)
+{
+	int i;
+
+	for (i = 0; i < SCHED_HIST_BUCKETS; ++i) {
+		if (!hist[i])
+			continue;
+
+		klog(KLOG_INFO, "sched:   %s <%llu ns: %u",
+		     name, 1ULL << i, hist[i]);
+	}
+}
+
+/*
+ * sched_stats_dump:
+ * Write the scheduler statistics of every online CPU to the kernel log.
+ */
+void sched_stats_dump(void)
+{
+	struct sched_stats *s;
+	int cpu, i;
+
+	for_each_cpu(cpu, cpumask_online()) {
+		s = cpu_ptr(&sched_stats, cpu);
+
+		klog(KLOG_INFO, "sched: cpu %d: %llu switches "
+		     "(%llu voluntary, %llu preempted)",
+		     cpu, s->switches, s->voluntary, s->preempted);
+
+		for (i = 0; i < SCHED_PRIO_LEVELS; ++i) {
+			if (!s->level_time[i])
+				continue;
+
+			klog(KLOG_INFO, "sched:   level %d: %llu ns",
+			     i, s->level_time[i]);
+		}
+
+		__hist_dump("wait", s->wait_hist);
+		__hist_dump("run ", s->run_hist);
+	}
+}
+
+#endif /* CONFIG_SCHED_STATS */
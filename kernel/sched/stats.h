@@ -0,0 +1,35 @@
+/*
+ * kernel/sched/stats.h
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNEL_SCHED_STATS_H
+#define KERNEL_SCHED_STATS_H
+
+#include <radix/task.h>
+
+#ifdef CONFIG_SCHED_STATS
+void sched_stats_enqueue(struct task *t, uint64_t now);
+void sched_stats_run(struct task *t, uint64_t elapsed);
+void sched_stats_switch(struct task *prev, struct task *next,
+                        int voluntary, uint64_t now);
+#else
+#define sched_stats_enqueue(t, now)
+#define sched_stats_run(t, elapsed)
+#define sched_stats_switch(prev, next, voluntary, now)
+#endif /* CONFIG_SCHED_STATS */
+
+#endif /* KERNEL_SCHED_STATS_H */
@@ -18,15 +18,21 @@
 
 #include <radix/error.h>
 #include <radix/kernel.h>
+#include <radix/klog.h>
 #include <radix/kthread.h>
 #include <radix/sched.h>
 #include <radix/slab.h>
+#include <radix/spinlock.h>
 #include <radix/tasking.h>
 
 #include <rlibc/string.h>
 
 static struct slab_cache *task_cache;
 
+/* every task in the system, for debugging and accounting */
+static struct list task_list = LIST_INIT(task_list);
+static spinlock_t task_list_lock = SPINLOCK_INIT;
+
 static void task_init(void *t);
 
 void tasking_init(void)
@@ -44,12 +50,13 @@ void tasking_init(void)
 	 * as the current task. When the first context switch occurs, registers
 	 * will be saved to turn the stub into a proper task.
 	 */
-	curr = alloc_cache(task_cache);
+	curr = kthread_task();
 	if (IS_ERR(curr)) {
 		panic("failed to allocate task for main kernel thread: %s\n",
 		      strerror(ERR_VAL(curr)));
 	}
 	curr->state = TASK_RUNNING;
+	kernel_reg_setup(&curr->regs);
 	curr->cmdline = kmalloc(sizeof (*curr->cmdline) << 1);
 	curr->cmdline[0] = kmalloc(KTHREAD_NAME_LEN);
 	strcpy(curr->cmdline[0], "kernel_boot_thread");
@@ -61,14 +68,107 @@ void tasking_init(void)
 /* Allocate and initialize a new task struct for a kthread. */
 struct task *kthread_task(void)
 {
-	return alloc_cache(task_cache);
+	struct task *task;
+	unsigned long irqstate;
+
+	task = alloc_cache(task_cache);
+	if (IS_ERR(task))
+		return task;
+
+	spin_lock_irq(&task_list_lock, &irqstate);
+	list_add(&task_list, &task->task_list);
+	spin_unlock_irq(&task_list_lock, irqstate);
+
+	return task;
 }
 
 void task_free(struct task *task)
 {
+	unsigned long irqstate;
+
+	spin_lock_irq(&task_list_lock, &irqstate);
+	list_del(&task->task_list);
+	spin_unlock_irq(&task_list_lock, irqstate);
+
 	free_cache(task_cache, task);
 }
 
+struct task_snapshot {
+	struct task     *task;
+	char            name[KTHREAD_NAME_LEN];
+	int             cpu;
+	unsigned long   state;
+	uint64_t        run_cycles;
+	uint64_t        wait_cycles;
+	unsigned long   nr_voluntary;
+	unsigned long   nr_involuntary;
+};
+
+static void __task_snapshot(struct task_snapshot *s, struct task *t)
+{
+	s->task = t;
+	if (t->cmdline && t->cmdline[0])
+		strncpy(s->name, t->cmdline[0], KTHREAD_NAME_LEN - 1);
+	else
+		strcpy(s->name, "?");
+	s->name[KTHREAD_NAME_LEN - 1] = '\0';
+	s->cpu = t->cpu;
+	s->state = t->state;
+	s->run_cycles = t->run_cycles;
+	s->wait_cycles = t->wait_cycles;
+	s->nr_voluntary = t->nr_voluntary;
+	s->nr_involuntary = t->nr_involuntary;
+}
+
+/*
+ * task_dump_top:
+ * Write the `n` tasks which have run for the most cycles to the kernel log,
+ * along with their wait times and context switch counts. At most
+ * TASK_DUMP_MAX tasks are listed.
+ */
+void task_dump_top(int n)
+{
+	struct task_snapshot top[TASK_DUMP_MAX];
+	unsigned long irqstate;
+	uint64_t total;
+	struct task *t;
+	int i, count;
+
+	n = min(n, TASK_DUMP_MAX);
+	count = 0;
+	total = 0;
+
+	/* insertion sort the top `n` tasks into the array by run time */
+	spin_lock_irq(&task_list_lock, &irqstate);
+	list_for_each_entry(t, &task_list, task_list) {
+		total += t->run_cycles;
+
+		for (i = count; i > 0; --i) {
+			if (top[i - 1].run_cycles >= t->run_cycles)
+				break;
+			if (i < n)
+				top[i] = top[i - 1];
+		}
+		if (i < n) {
+			__task_snapshot(&top[i], t);
+			if (count < n)
+				++count;
+		}
+	}
+	spin_unlock_irq(&task_list_lock, irqstate);
+
+	klog(KLOG_INFO, "task: top %d of %llu total cycles run", count, total);
+	for (i = 0; i < count; ++i) {
+		klog(KLOG_INFO, "task: %s: cpu %d state %lu run %llu (%llu%%) "
+		     "wait %llu switches %lu/%lu",
+		     top[i].name, top[i].cpu, top[i].state,
+		     top[i].run_cycles,
+		     total ? top[i].run_cycles * 100 / total : 0,
+		     top[i].wait_cycles,
+		     top[i].nr_voluntary, top[i].nr_involuntary);
+	}
+}
+
 static void task_init(void *t)
 {
 	struct task *task;
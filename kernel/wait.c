@@ -0,0 +1,91 @@
+/*
+ * kernel/wait.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/sched.h>
+#include <radix/wait.h>
+
+void wait_queue_init(struct wait_queue *wq)
+{
+	list_init(&wq->head);
+	spin_init(&wq->lock);
+}
+
+/*
+ * prepare_to_wait:
+ * Add wait entry `w` to wait queue `wq` and mark its task as blocked.
+ * The caller should check its wait condition after this and only call
+ * schedule if it is false, ensuring that no wakeup is missed.
+ */
+void prepare_to_wait(struct wait_queue *wq, struct wait_entry *w)
+{
+	unsigned long irqstate;
+
+	spin_lock_irq(&wq->lock, &irqstate);
+	if (list_empty(&w->list))
+		list_ins(&wq->head, &w->list);
+	w->task->state = TASK_BLOCKED;
+	spin_unlock_irq(&wq->lock, irqstate);
+}
+
+/*
+ * finish_wait:
+ * Mark the task of wait entry `w` as running and remove `w`
+ * from wait queue `wq` if it is still queued.
+ */
+void finish_wait(struct wait_queue *wq, struct wait_entry *w)
+{
+	unsigned long irqstate;
+
+	w->task->state = TASK_RUNNING;
+
+	spin_lock_irq(&wq->lock, &irqstate);
+	if (!list_empty(&w->list))
+		list_del(&w->list);
+	spin_unlock_irq(&wq->lock, irqstate);
+}
+
+/*
+ * __wake_up:
+ * Wake up to `nr` tasks waiting in `wq`, in the order in which they began
+ * waiting. Woken entries are removed from the queue.
+ */
+static void __wake_up(struct wait_queue *wq, int nr)
+{
+	struct wait_entry *w;
+	unsigned long irqstate;
+
+	spin_lock_irq(&wq->lock, &irqstate);
+	while (nr-- && !list_empty(&wq->head)) {
+		w = list_first_entry(&wq->head, struct wait_entry, list);
+		list_del(&w->list);
+		sched_unblock(w->task);
+	}
+	spin_unlock_irq(&wq->lock, irqstate);
+}
+
+/* wake_up: wake the first task waiting in `wq` */
+void wake_up(struct wait_queue *wq)
+{
+	__wake_up(wq, 1);
+}
+
+/* wake_up_all: wake every task waiting in `wq` */
+void wake_up_all(struct wait_queue *wq)
+{
+	__wake_up(wq, -1);
+}
@@ -0,0 +1,396 @@
+/*
+ * kernel/workqueue.c
+ * Copyright (C) 2018 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/assert.h>
+#include <radix/atomic.h>
+#include <radix/error.h>
+#include <radix/event.h>
+#include <radix/irq.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/percpu.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/spinlock.h>
+#include <radix/time.h>
+#include <radix/wait.h>
+#include <radix/workqueue.h>
+
+#include <rlibc/string.h>
+
+#define WQ "workqueue: "
+
+#define WORKER_STACK_ORDER      1
+#define WORKER_MAX              8
+#define WORKER_IDLE_TIMEOUT     (5 * NSEC_PER_SEC)
+#define WORKER_RETRY_DELAY      (100 * NSEC_PER_MSEC)
+
+/* A kernel thread running work items, which lives on its own stack. */
+struct worker {
+	struct work             *current_work;
+	struct list             list;
+};
+
+/*
+ * The workers of a single CPU and the work queued for them.
+ *
+ * A pool starts with a single worker. Whenever work is waiting with no
+ * idle worker to run it, the pool's manager thread is woken to start
+ * another, up to WORKER_MAX. This happens both when work is queued and
+ * when a worker takes an item with more queued behind it, so the pool
+ * does not stall when its workers block in their work functions.
+ * Workers which are idle for longer than WORKER_IDLE_TIMEOUT exit, down
+ * to the last one.
+ */
+struct worker_pool {
+	spinlock_t              lock;
+	struct list             worklist;
+	struct list             workers;
+	int                     nr_workers;
+	int                     nr_idle;
+	int                     nr_flushers;
+	int                     next_id;
+	int                     cpu;
+	struct wait_queue       idle_wq;
+	struct wait_queue       flush_wq;
+	struct wait_queue       manager_wq;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pool);
+
+static int __create_worker(struct worker_pool *pool, int id);
+
+/*
+ * __need_worker:
+ * Check whether `pool` has work waiting which no idle worker will take.
+ * The pool's lock must be held.
+ */
+static __always_inline int __need_worker(struct worker_pool *pool)
+{
+	return !list_empty(&pool->worklist) && !pool->nr_idle &&
+	       pool->nr_workers < WORKER_MAX;
+}
+
+/*
+ * __worker_idle:
+ * Wait for work to be queued in `pool`. The pool's lock must be held,
+ * and is held again on return. Returns 0 if the worker timed out and
+ * should exit, having been removed from the pool's count.
+ */
+static int __worker_idle(struct worker_pool *pool, unsigned long *irqstate)
+{
+	int woken;
+
+	++pool->nr_idle;
+	spin_unlock_irq(&pool->lock, *irqstate);
+
+	woken = wait_event_timeout(&pool->idle_wq,
+	                           !list_empty(&pool->worklist),
+	                           WORKER_IDLE_TIMEOUT);
+
+	spin_lock_irq(&pool->lock, irqstate);
+	--pool->nr_idle;
+
+	if (woken || !list_empty(&pool->worklist) || pool->nr_workers == 1)
+		return 1;
+
+	--pool->nr_workers;
+	return 0;
+}
+
+static void worker_thread(void *arg)
+{
+	struct worker_pool *pool;
+	struct worker self;
+	struct work *w;
+	unsigned long irqstate;
+
+	pool = arg;
+	self.current_work = NULL;
+
+	spin_lock_irq(&pool->lock, &irqstate);
+	list_ins(&pool->workers, &self.list);
+
+	/* counted as idle by the manager until it got here */
+	--pool->nr_idle;
+
+	while (1) {
+		if (list_empty(&pool->worklist)) {
+			if (!__worker_idle(pool, &irqstate))
+				break;
+			continue;
+		}
+
+		w = list_first_entry(&pool->worklist, struct work, list);
+		list_del(&w->list);
+		atomic_write(&w->pending, 0);
+		self.current_work = w;
+
+		if (__need_worker(pool))
+			wake_up(&pool->manager_wq);
+		spin_unlock_irq(&pool->lock, irqstate);
+
+		w->func(w);
+
+		spin_lock_irq(&pool->lock, &irqstate);
+		self.current_work = NULL;
+		if (pool->nr_flushers)
+			wake_up_all(&pool->flush_wq);
+	}
+
+	list_del(&self.list);
+	spin_unlock_irq(&pool->lock, irqstate);
+}
+
+/*
+ * manager_thread:
+ * Start new workers for the pool `arg` whenever its work is not being
+ * taken. A new worker is counted as idle from the moment it is created,
+ * so that the manager does not start more while it is still starting up.
+ */
+static void manager_thread(void *arg)
+{
+	struct worker_pool *pool;
+	unsigned long irqstate;
+	int id;
+
+	pool = arg;
+
+	while (1) {
+		wait_event(&pool->manager_wq, __need_worker(pool));
+
+		spin_lock_irq(&pool->lock, &irqstate);
+		if (!__need_worker(pool)) {
+			spin_unlock_irq(&pool->lock, irqstate);
+			continue;
+		}
+		++pool->nr_workers;
+		++pool->nr_idle;
+		id = pool->next_id++;
+		spin_unlock_irq(&pool->lock, irqstate);
+
+		if (__create_worker(pool, id) != 0) {
+			spin_lock_irq(&pool->lock, &irqstate);
+			--pool->nr_workers;
+			--pool->nr_idle;
+			spin_unlock_irq(&pool->lock, irqstate);
+
+			/* back off before trying again */
+			sleep_until(time_ns() + WORKER_RETRY_DELAY);
+		}
+	}
+}
+
+static int __create_worker(struct worker_pool *pool, int id)
+{
+	struct task *t;
+
+	t = kthread_create(worker_thread, pool, WORKER_STACK_ORDER,
+	                   "kworker/%d:%d", pool->cpu, id);
+	if (IS_ERR(t)) {
+		klog(KLOG_WARNING, WQ "could not create worker for cpu %d: %s",
+		     pool->cpu, strerror(ERR_VAL(t)));
+		return ERR_VAL(t);
+	}
+
+	t->cpu_restrict = CPUMASK_CPU(pool->cpu);
+	kthread_start(t);
+
+	return 0;
+}
+
+/*
+ * workqueue_init:
+ * Set up the worker pool of each online CPU and start its first worker
+ * and its manager.
+ */
+void workqueue_init(void)
+{
+	struct worker_pool *pool;
+	struct task *t;
+	int cpu;
+
+	for_each_cpu(cpu, cpumask_online()) {
+		pool = cpu_ptr(&worker_pool, cpu);
+		spin_init(&pool->lock);
+		list_init(&pool->worklist);
+		list_init(&pool->workers);
+		wait_queue_init(&pool->idle_wq);
+		wait_queue_init(&pool->flush_wq);
+		wait_queue_init(&pool->manager_wq);
+		pool->cpu = cpu;
+		pool->nr_workers = 1;
+		pool->nr_idle = 1;
+		pool->next_id = 1;
+
+		if (__create_worker(pool, 0) != 0)
+			panic("could not start worker pool for cpu %d\n", cpu);
+
+		t = kthread_create(manager_thread, pool, WORKER_STACK_ORDER,
+		                   "kworker/%d:manager", cpu);
+		if (IS_ERR(t))
+			panic("could not start worker manager for cpu %d\n", cpu);
+		t->cpu_restrict = CPUMASK_CPU(cpu);
+		kthread_start(t);
+	}
+}
+
+void work_init(struct work *w, work_func_t func)
+{
+	list_init(&w->list);
+	w->func = func;
+	w->pending = 0;
+	w->cpu = 0;
+}
+
+void delayed_work_init(struct delayed_work *dw, work_func_t func)
+{
+	work_init(&dw->work, func);
+	dw->event = NULL;
+}
+
+/*
+ * __queue_work:
+ * Add work item `w`, which has been marked as pending,
+ * to the worker pool of `cpu`.
+ */
+static void __queue_work(int cpu, struct work *w)
+{
+	struct worker_pool *pool;
+	unsigned long irqstate;
+
+	pool = cpu_ptr(&worker_pool, cpu);
+	assert(pool->nr_workers);
+
+	spin_lock_irq(&pool->lock, &irqstate);
+	w->cpu = cpu;
+	list_ins(&pool->worklist, &w->list);
+	if (pool->nr_idle)
+		wake_up(&pool->idle_wq);
+	else if (__need_worker(pool))
+		wake_up(&pool->manager_wq);
+	spin_unlock_irq(&pool->lock, irqstate);
+}
+
+/*
+ * queue_work_on:
+ * Queue work item `w` to be run by a worker on `cpu`. A work item which is
+ * still pending is not queued again. It may, however, be queued while it
+ * is running, in which case it can run again concurrently.
+ *
+ * Returns 0 if the work was queued or EBUSY if it was already pending.
+ */
+int queue_work_on(int cpu, struct work *w)
+{
+	if (atomic_cmpxchg(&w->pending, 0, 1) != 0)
+		return EBUSY;
+
+	__queue_work(cpu, w);
+	return 0;
+}
+
+/* queue_work: queue work item `w` on the current CPU */
+int queue_work(struct work *w)
+{
+	return queue_work_on(processor_id(), w);
+}
+
+/*
+ * queue_delayed_work:
+ * Queue delayed work item `dw` to be run on the current CPU after
+ * `delay` nanoseconds.
+ *
+ * Returns 0 if the work was queued, EBUSY if it was already pending or
+ * an error code if its timer event could not be created.
+ */
+int queue_delayed_work(struct delayed_work *dw, uint64_t delay)
+{
+	unsigned long irqstate;
+	int err;
+
+	if (!delay)
+		return queue_work(&dw->work);
+
+	if (atomic_cmpxchg(&dw->work.pending, 0, 1) != 0)
+		return EBUSY;
+
+	irq_save(irqstate);
+	dw->work.cpu = processor_id();
+	if ((err = work_event_add(dw, time_ns() + delay)))
+		atomic_write(&dw->work.pending, 0);
+	irq_restore(irqstate);
+
+	return err;
+}
+
+/*
+ * delayed_work_timer:
+ * Queue delayed work `dw` whose delay has expired.
+ * Called from its timer event.
+ */
+void delayed_work_timer(struct delayed_work *dw)
+{
+	__queue_work(processor_id(), &dw->work);
+}
+
+/* __work_done: check whether `w` is neither pending nor running in `pool` */
+static int __work_done(struct worker_pool *pool, struct work *w)
+{
+	struct worker *worker;
+	unsigned long irqstate;
+	int done;
+
+	if (w->pending)
+		return 0;
+
+	done = 1;
+	spin_lock_irq(&pool->lock, &irqstate);
+	list_for_each_entry(worker, &pool->workers, list) {
+		if (worker->current_work == w) {
+			done = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&pool->lock, irqstate);
+
+	return done;
+}
+
+/*
+ * flush_work:
+ * Wait until the most recent queueing of work item `w` has finished
+ * running. Must not be called from `w` itself.
+ */
+void flush_work(struct work *w)
+{
+	struct worker_pool *pool;
+	unsigned long irqstate;
+
+	pool = cpu_ptr(&worker_pool, w->cpu);
+
+	spin_lock_irq(&pool->lock, &irqstate);
+	++pool->nr_flushers;
+	spin_unlock_irq(&pool->lock, irqstate);
+
+	wait_event(&pool->flush_wq, __work_done(pool, w));
+
+	spin_lock_irq(&pool->lock, &irqstate);
+	--pool->nr_flushers;
+	spin_unlock_irq(&pool->lock, irqstate);
+}